@@ -20,6 +20,7 @@
 #include "gap/Gap.h"
 #include "gap/AdvertisingDataParser.h"
 #include "pretty_printer.h"
+#include "BLEEventPump.h"
 
 /** This example demonstrates all the basic setup required
  *  to advertise, scan and connect to other devices.
@@ -35,6 +36,9 @@
 
 events::EventQueue event_queue;
 
+/* keeps a single BLE::processEvents pending in event_queue */
+BLEEventPump event_pump(event_queue);
+
 /* Duration of each mode in milliseconds */
 static const size_t MODE_DURATION_MS      = 6000;
 
@@ -734,23 +738,19 @@ private:
     ble::advertising_handle_t _adv_handles[ADV_SET_NUMBER];
 };
 
-/** Schedule processing of events from the BLE middleware in the event queue. */
-void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *context) {
-    event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
-}
-
 int main()
 {
     BLE &ble = BLE::Instance();
 
     /* this will inform us off all events so we can schedule their handling
      * using our event queue */
-    ble.onEventsToProcess(schedule_ble_events);
+    ble.onEventsToProcess(makeFunctionPointer(&event_pump, &BLEEventPump::schedule));
 
     GapDemo demo(ble, event_queue);
 
     while (1) {
         demo.run();
+        event_pump.print();
         wait_ms(TIME_BETWEEN_MODES_MS);
         printf("\r\nStarting next GAP demo mode\r\n");
     };
@@ -0,0 +1,122 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BLE_EVENT_PUMP_H_
+#define BLE_EVENT_PUMP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "events/EventQueue.h"
+#include "platform/mbed_critical.h"
+#include "platform/NonCopyable.h"
+
+#include "ble/BLE.h"
+
+/**
+ * Schedule processing of events from the BLE middleware in an event queue,
+ * with at most one call to BLE::processEvents pending at any time.
+ *
+ * The middleware signals every event it queues, often from interrupt
+ * context and in bursts. A single processEvents drains all of them, so a
+ * signal arriving while a call is already pending is only counted. The
+ * pending flag is cleared before the events are processed: an event queued
+ * during processing posts a new call and is never left behind.
+ *
+ * When the event queue pool is exhausted the post fails; the failure is
+ * counted and the flag released so that the next signal posts again.
+ */
+class BLEEventPump : private mbed::NonCopyable<BLEEventPump> {
+public:
+    BLEEventPump(events::EventQueue &event_queue) :
+        _event_queue(event_queue),
+        _ble(NULL),
+        _pending(0),
+        _signals(0),
+        _coalesced(0),
+        _dispatches(0),
+        _post_failures(0) {
+    }
+
+    /**
+     * Handler to register with BLE::onEventsToProcess.
+     */
+    void schedule(BLE::OnEventsToProcessCallbackContext *context)
+    {
+        _ble = &context->ble;
+        core_util_atomic_incr_u32(&_signals, 1);
+
+        uint8_t idle = 0;
+        if (!core_util_atomic_cas_u8(&_pending, &idle, 1)) {
+            core_util_atomic_incr_u32(&_coalesced, 1);
+            return;
+        }
+
+        if (!_event_queue.call(this, &BLEEventPump::process)) {
+            core_util_atomic_incr_u32(&_post_failures, 1);
+            _pending = 0;
+        }
+    }
+
+    /** Signals received from the middleware. */
+    uint32_t signals() const
+    {
+        return _signals;
+    }
+
+    /** Signals absorbed by a call already pending. */
+    uint32_t coalesced() const
+    {
+        return _coalesced;
+    }
+
+    /** Calls to BLE::processEvents. */
+    uint32_t dispatches() const
+    {
+        return _dispatches;
+    }
+
+    /** Posts refused because the event queue pool was exhausted. */
+    uint32_t postFailures() const
+    {
+        return _post_failures;
+    }
+
+    void print() const
+    {
+        printf("BLE events: %lu signals, %lu coalesced, %lu dispatches, %lu post failures\r\n",
+               (unsigned long)_signals, (unsigned long)_coalesced,
+               (unsigned long)_dispatches, (unsigned long)_post_failures);
+    }
+
+private:
+    void process()
+    {
+        _pending = 0;
+        _dispatches++;
+        _ble->processEvents();
+    }
+
+    events::EventQueue &_event_queue;
+    BLE *_ble;
+    volatile uint8_t _pending;
+    volatile uint32_t _signals;
+    volatile uint32_t _coalesced;
+    uint32_t _dispatches;
+    volatile uint32_t _post_failures;
+};
+
+#endif /* BLE_EVENT_PUMP_H_ */
@@ -0,0 +1,196 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATEWAY_FRAME_WRITER_H_
+#define GATEWAY_FRAME_WRITER_H_
+
+#include <mbed.h>
+
+/**
+ * Binary framed output of the gateway on a serial port.
+ *
+ * Every frame is self delimited and checked:
+ *
+ *   offset  field   type
+ *    0      sync    uint8   0xA5
+ *    1      length  uint8   bytes from type to the end of the body
+ *    2      type    uint8   FrameType
+ *    3      node    uint8   slot of the node in the gateway
+ *    4      time    uint32  gateway time in ms
+ *    8      body    length - 6 bytes
+ *    ...    crc     uint16  CRC-16/CCITT of bytes 1 to the end of the body
+ *
+ * All fields are little endian. A host resynchronises on a sync byte
+ * followed by a frame with a valid CRC, see tools/read_frames.py.
+ *
+ * Frames are queued whole in a ring buffer emptied by the transmit
+ * interrupt, so writing never blocks the event queue. A frame that does not
+ * fit is dropped whole and counted, the host never sees a partial frame.
+ */
+class FrameWriter : private mbed::NonCopyable<FrameWriter> {
+public:
+    enum FrameType {
+        /* body: value handle uint16, then the value */
+        FRAME_NOTIFICATION = 0x01,
+        /* body: peer address 6 bytes little endian, address type uint8 */
+        FRAME_NODE_UP = 0x02,
+        /* body: disconnection reason uint8 */
+        FRAME_NODE_DOWN = 0x03,
+        /* body: window ms, notifications, bytes, segments lost, frames dropped, all uint32 */
+        FRAME_NODE_STATS = 0x04
+    };
+
+    static const uint8_t SYNC = 0xA5;
+    static const unsigned HEADER_SIZE = 8;
+    static const unsigned CRC_SIZE = 2;
+    static const unsigned MAX_BODY_SIZE = 255 - (HEADER_SIZE - 2);
+
+    /**
+     * @param[in] buffer_size Size of the ring buffer, a power of two.
+     */
+    FrameWriter(PinName tx, PinName rx, int baud, uint8_t *buffer, unsigned buffer_size) :
+        _serial(tx, rx, baud),
+        _buffer(buffer),
+        _mask(buffer_size - 1),
+        _head(0),
+        _tail(0),
+        _tx_active(false),
+        _frames(0),
+        _dropped(0)
+    {
+    }
+
+    /**
+     * Queue a frame, the body is given in two parts to avoid a copy.
+     *
+     * @return false if the frame was dropped, the buffer being full.
+     */
+    bool write(
+        FrameType type, uint8_t node, uint32_t time_ms,
+        const uint8_t *head, unsigned head_size,
+        const uint8_t *body = NULL, unsigned body_size = 0
+    ) {
+        unsigned size = head_size + body_size;
+        if (size > MAX_BODY_SIZE) {
+            _dropped++;
+            return false;
+        }
+
+        unsigned frame_size = HEADER_SIZE + size + CRC_SIZE;
+        if (((_tail - _head - 1) & _mask) < frame_size) {
+            _dropped++;
+            return false;
+        }
+
+        uint8_t header[HEADER_SIZE] = {
+            SYNC,
+            (uint8_t)(HEADER_SIZE - 2 + size),
+            (uint8_t)type,
+            node,
+            (uint8_t)time_ms,
+            (uint8_t)(time_ms >> 8),
+            (uint8_t)(time_ms >> 16),
+            (uint8_t)(time_ms >> 24)
+        };
+
+        uint16_t crc = crc16(header + 1, HEADER_SIZE - 1);
+        crc = crc16(head, head_size, crc);
+        crc = crc16(body, body_size, crc);
+        uint8_t trailer[CRC_SIZE] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+
+        unsigned head_index = _head;
+        head_index = put(head_index, header, HEADER_SIZE);
+        head_index = put(head_index, head, head_size);
+        head_index = put(head_index, body, body_size);
+        head_index = put(head_index, trailer, CRC_SIZE);
+
+        // publish the frame to the interrupt once it is complete
+        __DMB();
+        _head = head_index;
+        _frames++;
+
+        kick();
+        return true;
+    }
+
+    /** Frames queued since boot. */
+    uint32_t frames() const
+    {
+        return _frames;
+    }
+
+    /** Frames dropped since boot because the buffer was full. */
+    uint32_t dropped() const
+    {
+        return _dropped;
+    }
+
+    static uint16_t crc16(const uint8_t *data, unsigned length, uint16_t crc = 0xFFFF)
+    {
+        while (length--) {
+            crc ^= (uint16_t)(*data++) << 8;
+            for (int i = 0; i < 8; i++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+private:
+    unsigned put(unsigned index, const uint8_t *data, unsigned length)
+    {
+        while (length--) {
+            _buffer[index] = *data++;
+            index = (index + 1) & _mask;
+        }
+        return index;
+    }
+
+    /* enable the transmit interrupt if it is not running already */
+    void kick()
+    {
+        CriticalSectionLock lock;
+        if (_tx_active) {
+            return;
+        }
+        _tx_active = true;
+        _serial.attach(callback(this, &FrameWriter::on_tx), SerialBase::TxIrq);
+    }
+
+    void on_tx()
+    {
+        while (_tail != _head && _serial.writeable()) {
+            _serial.putc(_buffer[_tail]);
+            _tail = (_tail + 1) & _mask;
+        }
+
+        if (_tail == _head) {
+            _serial.attach(Callback<void()>(), SerialBase::TxIrq);
+            _tx_active = false;
+        }
+    }
+
+    RawSerial _serial;
+    uint8_t *_buffer;
+    unsigned _mask;
+    volatile unsigned _head;
+    volatile unsigned _tail;
+    volatile bool _tx_active;
+    uint32_t _frames;
+    uint32_t _dropped;
+};
+
+#endif /* GATEWAY_FRAME_WRITER_H_ */
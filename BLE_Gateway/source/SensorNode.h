@@ -0,0 +1,360 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATEWAY_SENSOR_NODE_H_
+#define GATEWAY_SENSOR_NODE_H_
+
+#include <mbed.h>
+#include "ble/BLE.h"
+#include "ble/DiscoveredCharacteristic.h"
+#include "ble/CharacteristicDescriptorDiscovery.h"
+
+#include "FrameWriter.h"
+
+/* BlueST streams cut in numbered segments: shock capture and log download */
+static const UUID capture_uuid("00000000-0012-11e1-ac36-0002a5d5c51b");
+static const UUID log_uuid("00000000-0013-11e1-ac36-0002a5d5c51b");
+
+/**
+ * One sensor node connected to the gateway.
+ *
+ * A node goes through the GATT setup once per connection: discovery of its
+ * characteristics, then a CCCD write for every characteristic that
+ * notifies. Afterwards every notification is forwarded as a frame.
+ *
+ * The GattClient callbacks shared by all connections (discovery
+ * termination, write responses, notifications) are routed to the node by
+ * the gateway from the connection handle.
+ *
+ * For the window since the last report the node counts notifications and
+ * bytes, frames the serial output had to drop and segments missing from
+ * the segmented streams: their notifications start with a 2 byte index,
+ * bit 15 on the last segment, a jump in the index is a loss.
+ */
+class SensorNode : private mbed::NonCopyable<SensorNode> {
+    typedef SensorNode Self;
+
+    typedef CharacteristicDescriptorDiscovery::DiscoveryCallbackParams_t
+        DiscoveryCallbackParams_t;
+
+    typedef CharacteristicDescriptorDiscovery::TerminationCallbackParams_t
+        TerminationCallbackParams_t;
+
+public:
+    static const size_t MAX_CHARACTERISTICS = 10;
+
+    enum State {
+        FREE,
+        CONNECTED,
+        DISCOVERING,
+        SUBSCRIBING,
+        STREAMING
+    };
+
+    SensorNode() :
+        _id(0),
+        _state(FREE),
+        _client(NULL),
+        _connection_handle(0),
+        _count(0),
+        _current(0),
+        _cccd_handle(0)
+    {
+        clear_window(0);
+    }
+
+    void set_id(uint8_t id)
+    {
+        _id = id;
+    }
+
+    uint8_t id() const
+    {
+        return _id;
+    }
+
+    State state() const
+    {
+        return _state;
+    }
+
+    ble::connection_handle_t connection_handle() const
+    {
+        return _connection_handle;
+    }
+
+    const ble::address_t &peer_address() const
+    {
+        return _peer_address;
+    }
+
+    /**
+     * Take the node for a new connection, the GATT setup waits for setup().
+     */
+    void attach(
+        GattClient &client,
+        ble::connection_handle_t connection_handle,
+        const ble::address_t &peer_address,
+        uint32_t now_ms
+    ) {
+        _client = &client;
+        _connection_handle = connection_handle;
+        _peer_address = peer_address;
+        _count = 0;
+        _current = 0;
+        _cccd_handle = 0;
+        _state = CONNECTED;
+        clear_window(now_ms);
+    }
+
+    void release()
+    {
+        _state = FREE;
+        _client = NULL;
+    }
+
+    /**
+     * Start the GATT setup, on_done is called once the node streams or the
+     * setup failed.
+     */
+    void setup(mbed::Callback<void()> on_done)
+    {
+        _on_setup_done = on_done;
+        _state = DISCOVERING;
+
+        ble_error_t error = _client->launchServiceDiscovery(
+            _connection_handle,
+            NULL,
+            makeFunctionPointer(this, &Self::when_characteristic_discovered)
+        );
+
+        if (error) {
+            end_setup();
+        }
+    }
+
+    /** Service discovery of this connection ended. */
+    void when_discovery_ends()
+    {
+        if (_state != DISCOVERING) {
+            return;
+        }
+
+        _state = SUBSCRIBING;
+        _current = 0;
+        subscribe_current();
+    }
+
+    /** Write response received on this connection. */
+    void when_written(const GattWriteCallbackParams *event)
+    {
+        if (_state != SUBSCRIBING || event->handle != _cccd_handle) {
+            return;
+        }
+
+        _current++;
+        subscribe_current();
+    }
+
+    /** Notification or indication received on this connection. */
+    void when_notified(const GattHVXCallbackParams *event, FrameWriter &output, uint32_t now_ms)
+    {
+        _notifications++;
+        _bytes += event->len;
+
+        Characteristic *characteristic = find(event->handle);
+        if (characteristic && characteristic->segmented && event->len >= 2) {
+            uint16_t index = (event->data[0] | (event->data[1] << 8)) & 0x7FFF;
+            if (index && index != characteristic->next_index) {
+                _segments_lost += (uint16_t)(index - characteristic->next_index) & 0x7FFF;
+            }
+            characteristic->next_index = (event->data[1] & 0x80) ? 0 : index + 1;
+        }
+
+        uint8_t handle[2] = { (uint8_t)event->handle, (uint8_t)(event->handle >> 8) };
+        bool written = output.write(
+            FrameWriter::FRAME_NOTIFICATION, _id, now_ms,
+            handle, sizeof(handle), event->data, event->len
+        );
+
+        if (!written) {
+            _frames_dropped++;
+        }
+    }
+
+    /** Write the statistics of the window as a frame and start a new one. */
+    void report(FrameWriter &output, uint32_t now_ms)
+    {
+        uint32_t values[5] = {
+            now_ms - _window_start_ms,
+            _notifications,
+            _bytes,
+            _segments_lost,
+            _frames_dropped
+        };
+
+        uint8_t body[sizeof(values)];
+        for (size_t i = 0; i < 5; i++) {
+            body[4 * i] = (uint8_t)values[i];
+            body[4 * i + 1] = (uint8_t)(values[i] >> 8);
+            body[4 * i + 2] = (uint8_t)(values[i] >> 16);
+            body[4 * i + 3] = (uint8_t)(values[i] >> 24);
+        }
+
+        output.write(FrameWriter::FRAME_NODE_STATS, _id, now_ms, body, sizeof(body));
+        clear_window(now_ms);
+    }
+
+private:
+    struct Characteristic {
+        DiscoveredCharacteristic value;
+        bool segmented;
+        uint16_t next_index;
+    };
+
+    void when_characteristic_discovered(const DiscoveredCharacteristic *discovered)
+    {
+        DiscoveredCharacteristic::Properties_t properties = discovered->getProperties();
+        if (!(properties.notify() || properties.indicate()) || _count == MAX_CHARACTERISTICS) {
+            return;
+        }
+
+        Characteristic &characteristic = _characteristics[_count++];
+        characteristic.value = *discovered;
+        characteristic.segmented =
+            discovered->getUUID() == capture_uuid || discovered->getUUID() == log_uuid;
+        characteristic.next_index = 0;
+    }
+
+    /*
+     * Write the CCCD of the current characteristic. It is found without a
+     * descriptor discovery when it is the only descriptor of the
+     * characteristic.
+     */
+    void subscribe_current()
+    {
+        if (_current == _count) {
+            _state = STREAMING;
+            end_setup();
+            return;
+        }
+
+        const DiscoveredCharacteristic &characteristic = _characteristics[_current].value;
+        if (characteristic.getLastHandle() == characteristic.getValueHandle() + 1) {
+            _cccd_handle = characteristic.getLastHandle();
+            write_cccd();
+            return;
+        }
+
+        _cccd_handle = 0;
+        ble_error_t error = characteristic.discoverDescriptors(
+            makeFunctionPointer(this, &Self::when_descriptor_discovered),
+            makeFunctionPointer(this, &Self::when_descriptor_discovery_ends)
+        );
+
+        if (error) {
+            end_setup();
+        }
+    }
+
+    void when_descriptor_discovered(const DiscoveryCallbackParams_t *event)
+    {
+        if (event->descriptor.getUUID() == BLE_UUID_DESCRIPTOR_CLIENT_CHAR_CONFIG) {
+            _cccd_handle = event->descriptor.getAttributeHandle();
+            _client->terminateCharacteristicDescriptorDiscovery(event->characteristic);
+        }
+    }
+
+    void when_descriptor_discovery_ends(const TerminationCallbackParams_t *event)
+    {
+        if (!_cccd_handle) {
+            // skip a characteristic without CCCD
+            _current++;
+            subscribe_current();
+            return;
+        }
+
+        write_cccd();
+    }
+
+    void write_cccd()
+    {
+        DiscoveredCharacteristic::Properties_t properties =
+            _characteristics[_current].value.getProperties();
+
+        // notifications are preferred, they need no confirmation
+        uint16_t cccd_value = properties.notify() ? 0x0001 : 0x0002;
+
+        ble_error_t error = _client->write(
+            GattClient::GATT_OP_WRITE_REQ,
+            _connection_handle,
+            _cccd_handle,
+            sizeof(cccd_value),
+            reinterpret_cast<uint8_t*>(&cccd_value)
+        );
+
+        if (error) {
+            end_setup();
+        }
+    }
+
+    void end_setup()
+    {
+        if (_on_setup_done) {
+            mbed::Callback<void()> on_done = _on_setup_done;
+            _on_setup_done = mbed::Callback<void()>();
+            on_done();
+        }
+    }
+
+    Characteristic *find(GattAttribute::Handle_t handle)
+    {
+        for (size_t i = 0; i < _count; i++) {
+            if (_characteristics[i].value.getValueHandle() == handle) {
+                return &_characteristics[i];
+            }
+        }
+        return NULL;
+    }
+
+    void clear_window(uint32_t now_ms)
+    {
+        _window_start_ms = now_ms;
+        _notifications = 0;
+        _bytes = 0;
+        _segments_lost = 0;
+        _frames_dropped = 0;
+    }
+
+    uint8_t _id;
+    State _state;
+    GattClient *_client;
+    ble::connection_handle_t _connection_handle;
+    ble::address_t _peer_address;
+    Characteristic _characteristics[MAX_CHARACTERISTICS];
+    size_t _count;
+    size_t _current;
+    GattAttribute::Handle_t _cccd_handle;
+    mbed::Callback<void()> _on_setup_done;
+
+    uint32_t _window_start_ms;
+    uint32_t _notifications;
+    uint32_t _bytes;
+    uint32_t _segments_lost;
+    uint32_t _frames_dropped;
+};
+
+#endif /* GATEWAY_SENSOR_NODE_H_ */
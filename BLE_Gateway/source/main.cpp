@@ -0,0 +1,377 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <events/mbed_events.h>
+#include <mbed.h>
+#include "ble/BLE.h"
+#include "ble/gap/Gap.h"
+#include "ble/gap/AdvertisingDataParser.h"
+
+#include "BLEEventPump.h"
+#include "FrameWriter.h"
+#include "SensorNode.h"
+
+/* One node per link the controller can hold */
+static const size_t MAX_NODES = MBED_CONF_CORDIO_MAX_CONNECTIONS;
+
+/* Connection interval shared by all nodes */
+static const uint32_t CONNECTION_INTERVAL_MS = MBED_CONF_APP_CONNECTION_INTERVAL_MS;
+
+/* Give up a connection attempt to a node that went away */
+static const int CONNECT_TIMEOUT_MS = MBED_CONF_APP_CONNECT_TIMEOUT_MS;
+
+/* Period of the per node statistics frames */
+static const int REPORT_MS = MBED_CONF_APP_REPORT_MS;
+
+/* Ring buffer of the serial output, a power of two */
+static const unsigned FRAME_BUFFER_SIZE = MBED_CONF_APP_FRAME_BUFFER_SIZE;
+
+/* BlueST manufacturer data: protocol version, device id, features [, address] */
+static const uint8_t BLUEST_PROTOCOL_VERSION = 0x01;
+
+static EventQueue event_queue(/* event count */ 16 * EVENTS_EVENT_SIZE);
+
+static BLEEventPump event_pump(event_queue);
+
+static uint8_t frame_buffer[FRAME_BUFFER_SIZE];
+
+/**
+ * Gateway collecting the streams of many BlueST sensor nodes.
+ *
+ * The gateway scans for nodes advertising BlueST manufacturer data and
+ * connects to them, up to one per link the controller supports. Each node
+ * is set up in turn and then streams its notifications, which are all
+ * written to the serial port as timestamped binary frames (FrameWriter),
+ * together with periodic statistics per node.
+ *
+ * Scheduling across connections:
+ * - a single connection attempt at a time, scanning resumes after it while
+ *   links are free;
+ * - all links share the same connection interval, so the central places
+ *   their connection events side by side on a common period;
+ * - the GATT setup runs for one node at a time: discovery traffic stays on
+ *   a single link while the others keep streaming.
+ */
+class GatewayDemo : ble::Gap::EventHandler {
+    typedef GatewayDemo Self;
+
+public:
+    GatewayDemo(BLE &ble, events::EventQueue &event_queue, FrameWriter &output) :
+        _ble(ble),
+        _event_queue(event_queue),
+        _output(output),
+        _alive_led(LED1, 1),
+        _scanning(false),
+        _connecting(false),
+        _connect_timeout_id(0),
+        _setup_node(NULL)
+    {
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            _nodes[i].set_id(i);
+        }
+    }
+
+    void start()
+    {
+        _ble.gap().setEventHandler(this);
+
+        _ble.init(this, &Self::on_init_complete);
+
+        _event_queue.call_every(500, this, &Self::blink);
+        _event_queue.call_every(REPORT_MS, this, &Self::report);
+
+        _event_queue.dispatch_forever();
+    }
+
+private:
+    /** Callback triggered when the ble initialization process has finished */
+    void on_init_complete(BLE::InitializationCompleteCallbackContext *params)
+    {
+        if (params->error != BLE_ERROR_NONE) {
+            return;
+        }
+
+        GattClient &client = _ble.gattClient();
+        client.onServiceDiscoveryTermination(makeFunctionPointer(this, &Self::when_discovery_ends));
+        client.onDataWritten().add(makeFunctionPointer(this, &Self::when_written));
+        client.onHVX().add(makeFunctionPointer(this, &Self::when_notified));
+
+        ble::ScanParameters scan_params;
+        _ble.gap().setScanParameters(scan_params);
+        start_scan();
+    }
+
+    void blink()
+    {
+        _alive_led = !_alive_led;
+    }
+
+    /** Scan while links are free and no connection is pending. */
+    void start_scan()
+    {
+        if (_scanning || _connecting || !find_free_node()) {
+            return;
+        }
+
+        if (_ble.gap().startScan() == BLE_ERROR_NONE) {
+            _scanning = true;
+        }
+    }
+
+    void stop_scan()
+    {
+        if (_scanning) {
+            _ble.gap().stopScan();
+            _scanning = false;
+        }
+    }
+
+private:
+    /* Event handler */
+
+    void onAdvertisingReport(const ble::AdvertisingReportEvent &event)
+    {
+        if (_connecting || !event.getType().connectable() ||
+            !is_sensor_node(event.getPayload()) || find_node(event.getPeerAddress())) {
+            return;
+        }
+
+        stop_scan();
+
+        ble::ConnectionParameters connection_params;
+        connection_params.setConnectionParameters(
+            ble::conn_interval_t(ble::millisecond_t(CONNECTION_INTERVAL_MS)),
+            ble::conn_interval_t(ble::millisecond_t(CONNECTION_INTERVAL_MS)),
+            ble::slave_latency_t(0),
+            ble::supervision_timeout_t(ble::millisecond_t(4000))
+        );
+
+        ble_error_t error = _ble.gap().connect(
+            event.getPeerAddressType(),
+            event.getPeerAddress(),
+            connection_params
+        );
+
+        if (error) {
+            start_scan();
+            return;
+        }
+
+        _connecting = true;
+        _connect_timeout_id = _event_queue.call_in(CONNECT_TIMEOUT_MS, this, &Self::when_connect_timeout);
+    }
+
+    void onConnectionComplete(const ble::ConnectionCompleteEvent &event)
+    {
+        _connecting = false;
+        _event_queue.cancel(_connect_timeout_id);
+
+        SensorNode *node = find_free_node();
+        if (event.getStatus() == BLE_ERROR_NONE && node &&
+            event.getOwnRole() == ble::connection_role_t::CENTRAL) {
+            node->attach(
+                _ble.gattClient(),
+                event.getConnectionHandle(),
+                event.getPeerAddress(),
+                _event_queue.tick()
+            );
+
+            uint8_t body[7];
+            memcpy(body, event.getPeerAddress().data(), 6);
+            body[6] = event.getPeerAddressType().value();
+            _output.write(FrameWriter::FRAME_NODE_UP, node->id(), _event_queue.tick(), body, sizeof(body));
+
+            setup_next_node();
+        }
+
+        start_scan();
+    }
+
+    void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event)
+    {
+        SensorNode *node = find_node(event.getConnectionHandle());
+        if (!node) {
+            return;
+        }
+
+        uint8_t reason = event.getReason().value();
+        _output.write(FrameWriter::FRAME_NODE_DOWN, node->id(), _event_queue.tick(), &reason, 1);
+
+        node->release();
+        if (node == _setup_node) {
+            _setup_node = NULL;
+            setup_next_node();
+        }
+
+        start_scan();
+    }
+
+    /** Cancel a connection attempt to a node which stopped advertising. */
+    void when_connect_timeout()
+    {
+        if (_connecting) {
+            _ble.gap().cancelConnect();
+        }
+    }
+
+private:
+    /* Routing of the GattClient events shared by all connections */
+
+    void when_discovery_ends(ble::connection_handle_t connection_handle)
+    {
+        SensorNode *node = find_node(connection_handle);
+        if (node) {
+            node->when_discovery_ends();
+        }
+    }
+
+    void when_written(const GattWriteCallbackParams *event)
+    {
+        SensorNode *node = find_node(event->connHandle);
+        if (node) {
+            node->when_written(event);
+        }
+    }
+
+    void when_notified(const GattHVXCallbackParams *event)
+    {
+        SensorNode *node = find_node(event->connHandle);
+        if (node) {
+            node->when_notified(event, _output, _event_queue.tick());
+        }
+    }
+
+private:
+    /* GATT setup, one node at a time */
+
+    void setup_next_node()
+    {
+        if (_setup_node) {
+            return;
+        }
+
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (_nodes[i].state() == SensorNode::CONNECTED) {
+                _setup_node = &_nodes[i];
+                _setup_node->setup(mbed::callback(this, &Self::when_setup_done));
+                return;
+            }
+        }
+    }
+
+    void when_setup_done()
+    {
+        SensorNode *node = _setup_node;
+        _setup_node = NULL;
+
+        // a node that cannot stream is dropped, it is taken again when it
+        // advertises next
+        if (node && node->state() != SensorNode::STREAMING) {
+            _ble.gap().disconnect(
+                node->connection_handle(),
+                ble::local_disconnection_reason_t::USER_TERMINATION
+            );
+        }
+
+        // the next setup starts from the event queue, not from the stack callback
+        _event_queue.call(this, &Self::setup_next_node);
+    }
+
+    void report()
+    {
+        uint32_t now = _event_queue.tick();
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (_nodes[i].state() != SensorNode::FREE) {
+                _nodes[i].report(_output, now);
+            }
+        }
+    }
+
+private:
+    static bool is_sensor_node(const mbed::Span<const uint8_t> &payload)
+    {
+        ble::AdvertisingDataParser adv_data(payload);
+
+        while (adv_data.hasNext()) {
+            ble::AdvertisingDataParser::element_t field = adv_data.next();
+
+            if (field.type == ble::adv_data_type_t::MANUFACTURER_SPECIFIC_DATA &&
+                (field.value.size() == 6 || field.value.size() == 12) &&
+                field.value[0] == BLUEST_PROTOCOL_VERSION) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    SensorNode *find_free_node()
+    {
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (_nodes[i].state() == SensorNode::FREE) {
+                return &_nodes[i];
+            }
+        }
+        return NULL;
+    }
+
+    SensorNode *find_node(ble::connection_handle_t connection_handle)
+    {
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (_nodes[i].state() != SensorNode::FREE &&
+                _nodes[i].connection_handle() == connection_handle) {
+                return &_nodes[i];
+            }
+        }
+        return NULL;
+    }
+
+    SensorNode *find_node(const ble::address_t &address)
+    {
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (_nodes[i].state() != SensorNode::FREE &&
+                _nodes[i].peer_address() == address) {
+                return &_nodes[i];
+            }
+        }
+        return NULL;
+    }
+
+    BLE &_ble;
+    events::EventQueue &_event_queue;
+    FrameWriter &_output;
+    DigitalOut _alive_led;
+    bool _scanning;
+    bool _connecting;
+    int _connect_timeout_id;
+    SensorNode _nodes[MAX_NODES];
+    SensorNode *_setup_node;
+};
+
+int main()
+{
+    static FrameWriter output(
+        USBTX, USBRX, MBED_CONF_APP_FRAME_BAUD_RATE, frame_buffer, FRAME_BUFFER_SIZE
+    );
+
+    BLE &ble = BLE::Instance();
+    ble.onEventsToProcess(makeFunctionPointer(&event_pump, &BLEEventPump::schedule));
+
+    static GatewayDemo demo(ble, event_queue, output);
+    demo.start();
+
+    return 0;
+}
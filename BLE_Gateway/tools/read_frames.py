@@ -0,0 +1,124 @@
+#!/usr/bin/env python
+"""Decode the binary frames written by BLE_Gateway on its serial port.
+
+Each frame is: sync 0xA5, length, type, node, time (uint32 ms), body and a
+CRC-16/CCITT of the bytes from length to the end of the body, all little
+endian (see source/FrameWriter.h). The decoder resynchronises on the next
+sync byte when a frame is corrupted.
+
+By default every frame is printed as CSV: time in ms, node, type, then the
+fields of the frame. With --stats only the statistics frames are printed,
+as throughput and loss per node.
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0xA5
+HEADER = struct.Struct('<BBBBI')
+
+FRAME_NOTIFICATION = 0x01
+FRAME_NODE_UP = 0x02
+FRAME_NODE_DOWN = 0x03
+FRAME_NODE_STATS = 0x04
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in bytearray(data):
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(source):
+    """Yield (type, node, time, body) for every valid frame of a stream."""
+    data = bytearray()
+    ended = False
+    while not ended:
+        chunk = source.read(4096)
+        ended = not chunk
+        data += chunk
+
+        offset = 0
+        while True:
+            start = data.find(bytearray([SYNC]), offset)
+            if start < 0:
+                offset = len(data)
+                break
+            end = start + 2 + data[start + 1] + 2 if start + 1 < len(data) else -1
+            if end < 0 or end > len(data):
+                if not ended:
+                    # wait for the rest of the frame
+                    offset = start
+                    break
+                # a sync byte in the data of a frame cut at the end
+                offset = start + 1
+                continue
+            _, length, kind, node, time = HEADER.unpack_from(data, start)
+            crc = struct.unpack_from('<H', data, end - 2)[0]
+            if length < 6 or crc16(data[start + 1:end - 2]) != crc:
+                sys.stderr.write('bad frame, resynchronising\n')
+                offset = start + 1
+                continue
+            yield kind, node, time, bytes(data[start + 8:end - 2])
+            offset = end
+        del data[:offset]
+
+
+def describe(kind, body):
+    if kind == FRAME_NOTIFICATION:
+        handle = struct.unpack_from('<H', body)[0]
+        return ['notification', handle, body[2:].hex()]
+    if kind == FRAME_NODE_UP:
+        address = ':'.join('%02x' % b for b in reversed(bytearray(body[:6])))
+        return ['up', address, bytearray(body)[6]]
+    if kind == FRAME_NODE_DOWN:
+        return ['down', '0x%02x' % bytearray(body)[0]]
+    if kind == FRAME_NODE_STATS:
+        return ['stats'] + list(struct.unpack('<5I', body))
+    return ['unknown', body.hex()]
+
+
+def print_stats(time, node, body):
+    window, notifications, size, lost, dropped = struct.unpack('<5I', body)
+    if not window:
+        return
+    print('%10.3f node %u: %.1f notifications/s, %.0f bytes/s, '
+          '%u segments lost, %u frames dropped' % (
+              time / 1000.0, node, notifications * 1000.0 / window,
+              size * 1000.0 / window, lost, dropped))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('port', help='capture of the serial port or a serial '
+                        'device, "-" for stdin')
+    parser.add_argument('--baud', type=int, default=460800,
+                        help='baud rate when reading a serial device')
+    parser.add_argument('--stats', action='store_true',
+                        help='print the statistics of every node only')
+    args = parser.parse_args()
+
+    if args.port == '-':
+        source = sys.stdin.buffer
+    elif args.port.startswith('/dev/') or args.port.startswith('COM'):
+        import serial
+        source = serial.Serial(args.port, args.baud)
+    else:
+        source = open(args.port, 'rb')
+
+    for kind, node, time, body in frames(source):
+        if args.stats:
+            if kind == FRAME_NODE_STATS:
+                print_stats(time, node, body)
+            continue
+        fields = [time, node] + describe(kind, body)
+        print(','.join(str(f) for f in fields))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
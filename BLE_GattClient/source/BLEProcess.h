@@ -30,6 +30,8 @@
 #include "ble/GapAdvertisingData.h"
 #include "ble/FunctionPointerWithContext.h"
 
+#include "BLEEventPump.h"
+
 /**
  * Handle initialization and shutdown of the BLE Instance.
  *
@@ -45,6 +47,7 @@ public:
      */
     BLEProcess(events::EventQueue &event_queue, BLE &ble_interface) :
         _event_queue(event_queue),
+        _event_pump(event_queue),
         _ble_interface(ble_interface),
         _post_init_cb() {
     }
@@ -67,7 +70,7 @@ public:
         }
 
         _ble_interface.onEventsToProcess(
-            makeFunctionPointer(this, &BLEProcess::schedule_ble_events)
+            makeFunctionPointer(&_event_pump, &BLEEventPump::schedule)
         );
 
         ble_error_t error = _ble_interface.init(
@@ -152,6 +155,7 @@ private:
     void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
     {
         printf("Disconnected.\r\n");
+        _event_pump.print();
         start_advertising();
     }
 
@@ -178,14 +182,6 @@ private:
         }
     }
 
-    /**
-     * Schedule processing of events from the BLE middleware in the event queue.
-     */
-    void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *event)
-    {
-        _event_queue.call(mbed::callback(&event->ble, &BLE::processEvents));
-    }
-
     /**
      * Build data advertised by the BLE interface.
      */
@@ -223,6 +219,7 @@ private:
     }
 
     events::EventQueue &_event_queue;
+    BLEEventPump _event_pump;
     BLE &_ble_interface;
     mbed::Callback<void(BLE&, events::EventQueue&)> _post_init_cb;
 };
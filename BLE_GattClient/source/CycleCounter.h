@@ -0,0 +1,50 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_CYCLE_COUNTER_H_
+#define GATT_EXAMPLE_CYCLE_COUNTER_H_
+
+#include <stdint.h>
+
+#include "cmsis.h"
+
+/**
+ * Thin wrapper over the DWT cycle counter of Cortex-M3/M4/M7 cores.
+ *
+ * On cores without a DWT (Cortex-M0/M0+) every read returns 0 so the
+ * benchmarks report nothing instead of failing to build.
+ */
+struct CycleCounter {
+    static void enable()
+    {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    }
+
+    static uint32_t read()
+    {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+        return DWT->CYCCNT;
+#else
+        return 0;
+#endif
+    }
+};
+
+#endif /* GATT_EXAMPLE_CYCLE_COUNTER_H_ */
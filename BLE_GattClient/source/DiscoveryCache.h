@@ -0,0 +1,218 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_DISCOVERY_CACHE_H_
+#define GATT_EXAMPLE_DISCOVERY_CACHE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kvstore_global_api.h"
+
+#include "ble/BLE.h"
+#include "ble/GattAttribute.h"
+
+/**
+ * Persistent cache of the GATT server discovered on a peer.
+ *
+ * An entry holds what the client needs to subscribe without any discovery:
+ * the value handle, the CCCD handle and the CCCD value of every
+ * characteristic that notifies or indicates, plus the handle of the
+ * Service Changed characteristic. Entries live in the global KVStore, one
+ * key per peer address.
+ *
+ * Outside of a bond the cache is only valid while the peer database is
+ * unchanged, so an entry is kept only for a peer exposing the Database
+ * Hash characteristic. The hash is saved with the entry and read again at
+ * its handle on reconnection: any other value, or a failed read, means the
+ * database changed and the entry is dropped.
+ */
+class DiscoveryCache {
+public:
+    static const size_t MAX_SUBSCRIPTIONS = 16;
+    static const size_t HASH_SIZE = 16;
+
+    struct Subscription {
+        GattAttribute::Handle_t value_handle;
+        GattAttribute::Handle_t cccd_handle;
+        uint16_t cccd_value;
+        // application tag restored with the subscription
+        uint8_t tag;
+    };
+
+    DiscoveryCache()
+    {
+        _key[0] = '\0';
+        clear();
+    }
+
+    /**
+     * Select the entry of a peer, the current content is cleared.
+     */
+    void select(const ble::address_t &peer)
+    {
+        const uint8_t *address = peer.data();
+        // the address is little endian, the key reads as it is printed
+        snprintf(
+            _key, sizeof(_key), "/kv/gattc%02x%02x%02x%02x%02x%02x",
+            address[5], address[4], address[3], address[2], address[1], address[0]
+        );
+        clear();
+    }
+
+    /**
+     * Start a new entry, e.g. before a full discovery.
+     */
+    void clear()
+    {
+        memset(&_entry, 0, sizeof(_entry));
+        _entry.version = VERSION;
+        _overflow = false;
+    }
+
+    /**
+     * Load the entry of the selected peer.
+     *
+     * @return true if a complete entry was found.
+     */
+    bool load()
+    {
+        size_t size = 0;
+        int status = kv_get(_key, &_entry, sizeof(_entry), &size);
+
+        if (status || size != sizeof(_entry) || _entry.version != VERSION ||
+            !_entry.hash_handle || _entry.count > MAX_SUBSCRIPTIONS) {
+            clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Save the entry of the selected peer if it can be validated later.
+     */
+    bool save()
+    {
+        if (!_entry.hash_handle || _overflow) {
+            return false;
+        }
+
+        int status = kv_set(_key, &_entry, sizeof(_entry), 0);
+        if (status) {
+            printf("Error %d while saving the discovery cache entry.\r\n", status);
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Drop the entry of the selected peer, stored or not.
+     */
+    void invalidate()
+    {
+        kv_remove(_key);
+        clear();
+    }
+
+    /**
+     * Record a subscription made during a full discovery.
+     */
+    void add(
+        GattAttribute::Handle_t value_handle,
+        GattAttribute::Handle_t cccd_handle,
+        uint16_t cccd_value,
+        uint8_t tag = 0
+    ) {
+        if (_entry.count == MAX_SUBSCRIPTIONS) {
+            _overflow = true;
+            return;
+        }
+
+        Subscription &subscription = _entry.subscriptions[_entry.count++];
+        subscription.value_handle = value_handle;
+        subscription.cccd_handle = cccd_handle;
+        subscription.cccd_value = cccd_value;
+        subscription.tag = tag;
+    }
+
+    /**
+     * Record the Database Hash read during a full discovery.
+     */
+    void set_hash(GattAttribute::Handle_t handle, const uint8_t *value, size_t length)
+    {
+        if (length != HASH_SIZE) {
+            return;
+        }
+
+        _entry.hash_handle = handle;
+        memcpy(_entry.hash, value, HASH_SIZE);
+    }
+
+    /**
+     * Compare the Database Hash read on reconnection with the one cached.
+     */
+    bool hash_matches(const uint8_t *value, size_t length) const
+    {
+        return length == HASH_SIZE && memcmp(_entry.hash, value, HASH_SIZE) == 0;
+    }
+
+    void set_service_changed_handle(GattAttribute::Handle_t handle)
+    {
+        _entry.service_changed_handle = handle;
+    }
+
+    GattAttribute::Handle_t hash_handle() const
+    {
+        return _entry.hash_handle;
+    }
+
+    GattAttribute::Handle_t service_changed_handle() const
+    {
+        return _entry.service_changed_handle;
+    }
+
+    size_t count() const
+    {
+        return _entry.count;
+    }
+
+    const Subscription &subscription(size_t index) const
+    {
+        return _entry.subscriptions[index];
+    }
+
+private:
+    // bump when the layout of Entry changes, older entries are then ignored
+    static const uint8_t VERSION = 2;
+
+    struct Entry {
+        uint8_t version;
+        uint8_t count;
+        GattAttribute::Handle_t hash_handle;
+        GattAttribute::Handle_t service_changed_handle;
+        uint8_t hash[HASH_SIZE];
+        Subscription subscriptions[MAX_SUBSCRIPTIONS];
+    };
+
+    char _key[sizeof("/kv/gattc") + 12];
+    Entry _entry;
+    bool _overflow;
+};
+
+#endif /* GATT_EXAMPLE_DISCOVERY_CACHE_H_ */
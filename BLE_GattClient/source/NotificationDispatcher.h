@@ -0,0 +1,213 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_NOTIFICATION_DISPATCHER_H_
+#define GATT_EXAMPLE_NOTIFICATION_DISPATCHER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hal/us_ticker_api.h"
+#include "platform/Callback.h"
+#include "platform/Span.h"
+
+#include "ble/GattAttribute.h"
+#include "ble/GattCallbackParamTypes.h"
+
+/**
+ * Dispatch notifications and indications to a handler per value handle.
+ *
+ * The subscriptions are kept in a table sorted by value handle, a
+ * notification is routed with a binary search. Handlers receive a span over
+ * the payload held by the stack: nothing is copied, and the span is only
+ * valid during the call.
+ *
+ * For each handle the dispatcher counts the notifications and bytes
+ * received since the last report and estimates the inter-arrival jitter
+ * the way RFC 3550 does for RTP: a running average, gain 1/16, of the
+ * difference between consecutive intervals.
+ */
+class NotificationDispatcher {
+public:
+    typedef mbed::Callback<void(GattAttribute::Handle_t, mbed::Span<const uint8_t>)> Handler;
+
+    static const size_t MAX_SUBSCRIPTIONS = 16;
+
+    NotificationDispatcher() :
+        _count(0),
+        _window_start_us(us_ticker_read()) {
+    }
+
+    /**
+     * Route the notifications of a value handle to a handler, the handler of
+     * a handle already subscribed is replaced.
+     *
+     * @return false if the table is full.
+     */
+    bool subscribe(GattAttribute::Handle_t handle, Handler handler)
+    {
+        Subscription *existing = find(handle);
+        if (existing) {
+            existing->handler = handler;
+            return true;
+        }
+
+        if (_count == MAX_SUBSCRIPTIONS) {
+            return false;
+        }
+
+        // reports are skipped while the table is empty, the window starts now
+        if (!_count) {
+            _window_start_us = us_ticker_read();
+        }
+
+        size_t position = _count;
+        while (position && _subscriptions[position - 1].handle > handle) {
+            _subscriptions[position] = _subscriptions[position - 1];
+            --position;
+        }
+
+        Subscription &subscription = _subscriptions[position];
+        subscription.handle = handle;
+        subscription.handler = handler;
+        subscription.notifications = 0;
+        subscription.bytes = 0;
+        subscription.started = false;
+        subscription.last_arrival_us = 0;
+        subscription.last_interval_us = 0;
+        subscription.jitter_us_x16 = 0;
+        ++_count;
+        return true;
+    }
+
+    /**
+     * Remove every subscription, e.g. on disconnection.
+     */
+    void clear()
+    {
+        _count = 0;
+    }
+
+    size_t count() const
+    {
+        return _count;
+    }
+
+    /**
+     * Route a notification or indication to its handler.
+     *
+     * @return false if the handle has no subscription.
+     */
+    bool dispatch(const GattHVXCallbackParams *event)
+    {
+        Subscription *subscription = find(event->handle);
+        if (!subscription) {
+            return false;
+        }
+
+        uint32_t now = us_ticker_read();
+        if (subscription->started) {
+            uint32_t interval = now - subscription->last_arrival_us;
+            if (subscription->last_interval_us) {
+                int32_t delta = (int32_t)(interval - subscription->last_interval_us);
+                uint32_t deviation = (delta < 0) ? -delta : delta;
+                subscription->jitter_us_x16 += deviation - ((subscription->jitter_us_x16 + 8) >> 4);
+            }
+            subscription->last_interval_us = interval;
+        }
+        subscription->started = true;
+        subscription->last_arrival_us = now;
+        subscription->notifications++;
+        subscription->bytes += event->len;
+
+        subscription->handler(
+            event->handle, mbed::Span<const uint8_t>(event->data, event->len)
+        );
+        return true;
+    }
+
+    /**
+     * Print the rates of every handle since the last report and start a new
+     * window.
+     */
+    void report()
+    {
+        uint32_t now = us_ticker_read();
+        uint32_t window_ms = (now - _window_start_us) / 1000;
+        _window_start_us = now;
+
+        if (!window_ms) {
+            return;
+        }
+
+        for (size_t i = 0; i < _count; ++i) {
+            Subscription &s = _subscriptions[i];
+
+            // hundredths of a notification per second
+            uint32_t rate = (uint32_t)((uint64_t)s.notifications * 100000 / window_ms);
+            uint32_t throughput = (uint32_t)((uint64_t)s.bytes * 1000 / window_ms);
+
+            printf(
+                "Handle %u: %lu.%02lu notifications/s, %lu bytes/s, jitter %lu us.\r\n",
+                s.handle,
+                (unsigned long)(rate / 100), (unsigned long)(rate % 100),
+                (unsigned long)throughput,
+                (unsigned long)(s.jitter_us_x16 >> 4)
+            );
+
+            s.notifications = 0;
+            s.bytes = 0;
+        }
+    }
+
+private:
+    struct Subscription {
+        GattAttribute::Handle_t handle;
+        Handler handler;
+        uint32_t notifications;
+        uint32_t bytes;
+        bool started;
+        uint32_t last_arrival_us;
+        uint32_t last_interval_us;
+        uint32_t jitter_us_x16;
+    };
+
+    Subscription *find(GattAttribute::Handle_t handle)
+    {
+        size_t low = 0;
+        size_t high = _count;
+
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+
+            if (_subscriptions[middle].handle == handle) {
+                return &_subscriptions[middle];
+            } else if (_subscriptions[middle].handle < handle) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        return NULL;
+    }
+
+    Subscription _subscriptions[MAX_SUBSCRIPTIONS];
+    size_t _count;
+    uint32_t _window_start_us;
+};
+
+#endif /* GATT_EXAMPLE_NOTIFICATION_DISPATCHER_H_ */
@@ -0,0 +1,360 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_STREAM_ANALYZER_H_
+#define GATT_EXAMPLE_STREAM_ANALYZER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hal/us_ticker_api.h"
+#include "platform/Span.h"
+
+#include "ble/UUID.h"
+#include "ble/GattAttribute.h"
+
+/* BlueST feature characteristics streamed by BLE_STBlue2_Sensor */
+static const UUID bluest_env_uuid("00040000-0001-11e1-ac36-0002a5d5c51b");
+static const UUID bluest_imu_uuid("00e00000-0001-11e1-ac36-0002a5d5c51b");
+static const UUID bluest_quat_uuid("00000100-0001-11e1-ac36-0002a5d5c51b");
+
+/**
+ * Health check of the BlueST sensor streams received by the client.
+ *
+ * Every BlueST feature value starts with a 16 bit timestamp followed by
+ * little endian int16 fields: temperature for env, accelerometer and
+ * gyroscope axes for the IMU, qi, qj and qk for the quaternion.
+ *
+ * For each stream the analyzer counts, over a report window:
+ * - the samples received, which gives the effective sample rate;
+ * - the duplicates: a timestamp that does not advance;
+ * - the malformed values, too short for the stream;
+ * - the sample age: the delay between the timestamp and the arrival,
+ *   relative to the least delayed sample of the window since both clocks
+ *   are not synchronised.
+ *
+ * The streams are sent by exception, on a change past a deadband or on a
+ * heartbeat: a long step between two timestamps is a suppressed sample
+ * rather than a lost one, so gaps are not counted.
+ *
+ * Older firmware leaves the timestamp at 0: duplicates cannot be told from
+ * the values then, only the longest interval between two arrivals is
+ * reported.
+ */
+class StreamAnalyzer {
+public:
+    enum StreamKind {
+        STREAM_NONE = 0,
+        STREAM_ENV,
+        STREAM_IMU,
+        STREAM_QUAT
+    };
+
+    static const size_t MAX_STREAMS = 4;
+
+    /* the STBlue2 firmware stamps its values with the event queue tick / 8 */
+    static const uint32_t TIMESTAMP_UNIT_MS = 8;
+
+    StreamAnalyzer() :
+        _count(0),
+        _window_start_us(us_ticker_read()) {
+    }
+
+    /**
+     * Stream carried by a characteristic, STREAM_NONE if not a BlueST one.
+     */
+    static StreamKind kind_of(const UUID &uuid)
+    {
+        if (uuid == bluest_env_uuid) {
+            return STREAM_ENV;
+        } else if (uuid == bluest_imu_uuid) {
+            return STREAM_IMU;
+        } else if (uuid == bluest_quat_uuid) {
+            return STREAM_QUAT;
+        }
+        return STREAM_NONE;
+    }
+
+    /**
+     * Analyze the values of a handle.
+     *
+     * @return false if the kind is unknown or the table is full.
+     */
+    bool add(GattAttribute::Handle_t handle, StreamKind kind)
+    {
+        if (kind == STREAM_NONE || _count == MAX_STREAMS) {
+            return false;
+        }
+
+        // reports are skipped while the table is empty, the window starts now
+        if (!_count) {
+            _window_start_us = us_ticker_read();
+        }
+
+        Stream &stream = _streams[_count++];
+        memset(&stream, 0, sizeof(stream));
+        stream.handle = handle;
+        stream.kind = kind;
+        return true;
+    }
+
+    void clear()
+    {
+        _count = 0;
+    }
+
+    size_t count() const
+    {
+        return _count;
+    }
+
+    /**
+     * Account a value received on a handle.
+     *
+     * @return false if the handle is not analyzed.
+     */
+    bool analyze(GattAttribute::Handle_t handle, mbed::Span<const uint8_t> value)
+    {
+        Stream *stream = find(handle);
+        if (!stream) {
+            return false;
+        }
+
+        uint32_t now = us_ticker_read();
+
+        if ((size_t)value.size() < value_size(stream->kind)) {
+            stream->malformed++;
+            return true;
+        }
+
+        uint16_t timestamp = value[0] | (value[1] << 8);
+        if (timestamp) {
+            stream->timestamped = true;
+        }
+
+        bool duplicate = stream->started && stream->timestamped &&
+            ((uint16_t)(timestamp - stream->last_timestamp) >= 0x8000 || timestamp == stream->last_timestamp);
+
+        if (duplicate) {
+            stream->duplicates++;
+            return true;
+        }
+
+        if (stream->started && !stream->timestamped) {
+            account_interval(*stream, now - stream->last_arrival_us);
+        }
+
+        if (stream->timestamped) {
+            account_age(*stream, timestamp, now);
+        }
+
+        stream->started = true;
+        stream->samples++;
+        stream->last_timestamp = timestamp;
+        stream->last_arrival_us = now;
+        memcpy(stream->last_value, value.data(), value_size(stream->kind));
+        return true;
+    }
+
+    /**
+     * Print a summary of every stream since the last report and start a new
+     * window.
+     */
+    void report()
+    {
+        uint32_t now = us_ticker_read();
+        uint32_t window_ms = (now - _window_start_us) / 1000;
+        _window_start_us = now;
+
+        if (!window_ms) {
+            return;
+        }
+
+        for (size_t i = 0; i < _count; ++i) {
+            Stream &s = _streams[i];
+
+            // hundredths of a sample per second
+            uint32_t rate = (uint32_t)((uint64_t)s.samples * 100000 / window_ms);
+
+            printf(
+                "Stream %s at %u: %lu.%02lu samples/s",
+                name(s.kind), s.handle,
+                (unsigned long)(rate / 100), (unsigned long)(rate % 100)
+            );
+            if (s.timestamped) {
+                printf(", %lu duplicates", (unsigned long)s.duplicates);
+            }
+            printf(", %lu malformed", (unsigned long)s.malformed);
+            if (s.timestamped) {
+                printf(
+                    ", age avg %lu max %lu ms",
+                    (unsigned long)(s.samples ? s.age_total_ms / s.samples : 0),
+                    (unsigned long)s.age_max_ms
+                );
+            } else {
+                printf(", max interval %lu ms", (unsigned long)(s.interval_max_us / 1000));
+            }
+            printf(".\r\n");
+
+            if (s.started) {
+                print_value(s);
+            }
+
+            s.samples = 0;
+            s.duplicates = 0;
+            s.malformed = 0;
+            s.age_total_ms = 0;
+            s.age_max_ms = 0;
+            s.age_anchored = false;
+            s.interval_max_us = 0;
+        }
+    }
+
+private:
+    static const size_t MAX_VALUE_SIZE = 14;
+
+    struct Stream {
+        GattAttribute::Handle_t handle;
+        StreamKind kind;
+        bool started;
+        bool timestamped;
+        uint16_t last_timestamp;
+        uint32_t last_arrival_us;
+        uint8_t last_value[MAX_VALUE_SIZE];
+
+        uint32_t interval_max_us;
+
+        // delay of a sample is (arrival - anchor) - (timestamp - anchor)
+        bool age_anchored;
+        uint32_t anchor_us;
+        uint32_t anchor_elapsed_ms;
+        int32_t delay_min_ms;
+
+        uint32_t samples;
+        uint32_t duplicates;
+        uint32_t malformed;
+        uint32_t age_total_ms;
+        uint32_t age_max_ms;
+    };
+
+    void account_interval(Stream &s, uint32_t interval)
+    {
+        if (interval > s.interval_max_us) {
+            s.interval_max_us = interval;
+        }
+    }
+
+    void account_age(Stream &s, uint16_t timestamp, uint32_t now)
+    {
+        if (!s.age_anchored) {
+            // new window: the first sample is the reference
+            s.age_anchored = true;
+            s.anchor_us = now;
+            s.anchor_elapsed_ms = 0;
+            s.delay_min_ms = 0;
+        } else {
+            s.anchor_elapsed_ms += (uint16_t)(timestamp - s.last_timestamp) * TIMESTAMP_UNIT_MS;
+        }
+
+        int32_t delay = (int32_t)((now - s.anchor_us) / 1000) - (int32_t)s.anchor_elapsed_ms;
+        if (delay < s.delay_min_ms) {
+            // a sample less delayed than the reference: shift the ages seen
+            s.age_total_ms += (uint32_t)(s.delay_min_ms - delay) * s.samples;
+            s.age_max_ms += s.delay_min_ms - delay;
+            s.delay_min_ms = delay;
+        }
+
+        uint32_t age = delay - s.delay_min_ms;
+        s.age_total_ms += age;
+        if (age > s.age_max_ms) {
+            s.age_max_ms = age;
+        }
+    }
+
+    static size_t value_size(StreamKind kind)
+    {
+        switch (kind) {
+            case STREAM_ENV:
+                return 4;
+            case STREAM_IMU:
+                return 14;
+            case STREAM_QUAT:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+
+    static const char *name(StreamKind kind)
+    {
+        switch (kind) {
+            case STREAM_ENV:
+                return "env";
+            case STREAM_IMU:
+                return "imu";
+            case STREAM_QUAT:
+                return "quat";
+            default:
+                return "?";
+        }
+    }
+
+    static int16_t field(const Stream &s, size_t index)
+    {
+        return (int16_t)(s.last_value[2 + 2 * index] | (s.last_value[3 + 2 * index] << 8));
+    }
+
+    static void print_value(const Stream &s)
+    {
+        switch (s.kind) {
+            case STREAM_ENV:
+                printf("\tlast: temperature %d.\r\n", field(s, 0));
+                break;
+            case STREAM_IMU:
+                printf(
+                    "\tlast: acc %d %d %d, gyro %d %d %d.\r\n",
+                    field(s, 0), field(s, 1), field(s, 2),
+                    field(s, 3), field(s, 4), field(s, 5)
+                );
+                break;
+            case STREAM_QUAT:
+                printf(
+                    "\tlast: qi %d qj %d qk %d (x10000).\r\n",
+                    field(s, 0), field(s, 1), field(s, 2)
+                );
+                break;
+            default:
+                break;
+        }
+    }
+
+    Stream *find(GattAttribute::Handle_t handle)
+    {
+        for (size_t i = 0; i < _count; ++i) {
+            if (_streams[i].handle == handle) {
+                return &_streams[i];
+            }
+        }
+        return NULL;
+    }
+
+    Stream _streams[MAX_STREAMS];
+    size_t _count;
+    uint32_t _window_start_us;
+};
+
+#endif /* GATT_EXAMPLE_STREAM_ANALYZER_H_ */
@@ -0,0 +1,304 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_TARGETED_DISCOVERY_H_
+#define GATT_EXAMPLE_TARGETED_DISCOVERY_H_
+
+#include <stdint.h>
+
+#include "events/EventQueue.h"
+#include "platform/Callback.h"
+#include "platform/NonCopyable.h"
+
+#include "ble/GattClient.h"
+#include "ble/DiscoveredService.h"
+#include "ble/DiscoveredCharacteristic.h"
+
+/**
+ * Discovery of a list of wanted characteristics instead of the whole server.
+ *
+ * Each target is a characteristic UUID in a service UUID. The services are
+ * searched one after the other by UUID (Discover Primary Service By
+ * Service UUID) so other services cost no round trip. When a service holds
+ * a single target, the characteristic UUID is given to the stack as well
+ * and the other characteristics are not reported.
+ *
+ * The discovery of a service is terminated as soon as its targets are
+ * resolved, without waiting for the end of its characteristics nor for
+ * other instances of the service. The whole procedure ends once every
+ * service has been searched.
+ */
+class TargetedDiscovery : private mbed::NonCopyable<TargetedDiscovery> {
+public:
+    typedef mbed::Callback<void(const DiscoveredCharacteristic *)> CharacteristicHandler;
+    typedef mbed::Callback<void(ble::connection_handle_t)> TerminationHandler;
+
+    static const size_t MAX_TARGETS = 8;
+
+    TargetedDiscovery() :
+        _client(NULL),
+        _event_queue(NULL),
+        _count(0),
+        _connection_handle(0),
+        _running(false),
+        _service_pending(false),
+        _terminating(false),
+        _service(NULL),
+        _searches(0) {
+    }
+
+    /**
+     * Add a characteristic to discover.
+     *
+     * @return false if the table of targets is full.
+     */
+    bool add(const UUID &service, const UUID &characteristic)
+    {
+        if (_count == MAX_TARGETS) {
+            return false;
+        }
+
+        Target &target = _targets[_count++];
+        target.service = service;
+        target.characteristic = characteristic;
+        target.searched = false;
+        target.resolved = false;
+        return true;
+    }
+
+    size_t count() const
+    {
+        return _count;
+    }
+
+    /** Targets found by the last discovery. */
+    size_t resolved() const
+    {
+        size_t resolved = 0;
+        for (size_t i = 0; i < _count; ++i) {
+            resolved += _targets[i].resolved;
+        }
+        return resolved;
+    }
+
+    /** Service searches made by the last discovery. */
+    unsigned searches() const
+    {
+        return _searches;
+    }
+
+    /**
+     * Discover the targets on a connection.
+     *
+     * on_characteristic is called for each target found, on_termination once
+     * the procedure has ended. The termination callback of the GattClient
+     * is used until then.
+     */
+    ble_error_t launch(
+        GattClient &client,
+        events::EventQueue &event_queue,
+        ble::connection_handle_t connection_handle,
+        CharacteristicHandler on_characteristic,
+        TerminationHandler on_termination
+    ) {
+        if (_running) {
+            return BLE_ERROR_INVALID_STATE;
+        }
+
+        for (size_t i = 0; i < _count; ++i) {
+            _targets[i].searched = false;
+            _targets[i].resolved = false;
+        }
+
+        _client = &client;
+        _event_queue = &event_queue;
+        _connection_handle = connection_handle;
+        _on_characteristic = on_characteristic;
+        _on_termination = on_termination;
+        _searches = 0;
+        _running = true;
+
+        _client->onServiceDiscoveryTermination(
+            makeFunctionPointer(this, &TargetedDiscovery::when_service_search_ends)
+        );
+
+        ble_error_t error = search_next_service();
+        if (error) {
+            _running = false;
+            _client->onServiceDiscoveryTermination(NULL);
+        }
+        return error;
+    }
+
+    /**
+     * Abandon the procedure, e.g. on disconnection. No callback is called.
+     */
+    void cancel()
+    {
+        if (!_running) {
+            return;
+        }
+
+        _running = false;
+        if (_service_pending) {
+            _service_pending = false;
+            _client->terminateServiceDiscovery();
+        }
+        _client->onServiceDiscoveryTermination(NULL);
+    }
+
+private:
+    struct Target {
+        UUID service;
+        UUID characteristic;
+        bool searched;
+        bool resolved;
+    };
+
+    /*
+     * Launch the search of the next service with unresolved targets, or end
+     * the procedure.
+     */
+    ble_error_t search_next_service()
+    {
+        _service = NULL;
+        size_t targets_in_service = 0;
+        const UUID *characteristic = NULL;
+
+        for (size_t i = 0; i < _count; ++i) {
+            Target &target = _targets[i];
+            if (target.searched) {
+                continue;
+            }
+            if (!_service) {
+                _service = &target.service;
+            }
+            if (target.service == *_service) {
+                target.searched = true;
+                characteristic = &target.characteristic;
+                targets_in_service++;
+            }
+        }
+
+        if (!_service) {
+            finish();
+            return BLE_ERROR_NONE;
+        }
+
+        _service_pending = true;
+        _terminating = false;
+        _searches++;
+
+        return _client->launchServiceDiscovery(
+            _connection_handle,
+            NULL,
+            makeFunctionPointer(this, &TargetedDiscovery::when_characteristic_discovered),
+            *_service,
+            targets_in_service == 1 ? *characteristic : UUID(BLE_UUID_UNKNOWN)
+        );
+    }
+
+    void when_characteristic_discovered(const DiscoveredCharacteristic *characteristic)
+    {
+        if (!_service_pending) {
+            return;
+        }
+
+        bool reported = false;
+        bool all_resolved = true;
+
+        for (size_t i = 0; i < _count; ++i) {
+            Target &target = _targets[i];
+            if (!(target.service == *_service)) {
+                continue;
+            }
+
+            if (!target.resolved && target.characteristic == characteristic->getUUID()) {
+                target.resolved = true;
+                if (!reported) {
+                    _on_characteristic(characteristic);
+                    reported = true;
+                }
+            }
+
+            all_resolved = all_resolved && target.resolved;
+        }
+
+        if (all_resolved && !_terminating) {
+            // the stack is in its callback: terminate from the event queue
+            _terminating = true;
+            _event_queue->call(this, &TargetedDiscovery::terminate_service_search, _searches);
+        }
+    }
+
+    void terminate_service_search(unsigned search)
+    {
+        // the search may have ended on its own meanwhile
+        if (!_running || !_service_pending || search != _searches) {
+            return;
+        }
+
+        // a termination reported synchronously by the stack is ignored
+        _service_pending = false;
+        _client->terminateServiceDiscovery();
+        search_or_finish();
+    }
+
+    void when_service_search_ends(ble::connection_handle_t connection_handle)
+    {
+        if (!_running || !_service_pending || connection_handle != _connection_handle) {
+            return;
+        }
+
+        // the stack is still tearing the search down: go on from the event queue
+        _service_pending = false;
+        _event_queue->call(this, &TargetedDiscovery::search_or_finish);
+    }
+
+    void search_or_finish()
+    {
+        if (!_running) {
+            return;
+        }
+
+        if (search_next_service()) {
+            finish();
+        }
+    }
+
+    void finish()
+    {
+        _running = false;
+        _service_pending = false;
+        _client->onServiceDiscoveryTermination(NULL);
+        _on_termination(_connection_handle);
+    }
+
+    GattClient *_client;
+    events::EventQueue *_event_queue;
+    Target _targets[MAX_TARGETS];
+    size_t _count;
+    ble::connection_handle_t _connection_handle;
+    bool _running;
+    bool _service_pending;
+    bool _terminating;
+    const UUID *_service;
+    unsigned _searches;
+    CharacteristicHandler _on_characteristic;
+    TerminationHandler _on_termination;
+};
+
+#endif /* GATT_EXAMPLE_TARGETED_DISCOVERY_H_ */
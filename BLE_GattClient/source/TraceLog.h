@@ -0,0 +1,304 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_EXAMPLE_TRACE_LOG_H_
+#define GATT_EXAMPLE_TRACE_LOG_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cmsis.h"
+#include "hal/us_ticker_api.h"
+#include "platform/mbed_assert.h"
+#include "platform/mbed_critical.h"
+#include "drivers/RawSerial.h"
+
+#define TRACE_LEVEL_DEBUG   0
+#define TRACE_LEVEL_INFO    1
+#define TRACE_LEVEL_WARNING 2
+#define TRACE_LEVEL_ERROR   3
+#define TRACE_LEVEL_NONE    4
+
+/* traces below this level are compiled out */
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL MBED_CONF_APP_TRACE_LEVEL
+#endif
+
+/*
+ * Record a trace: the format is a string literal, followed by up to 4
+ * integer or pointer arguments. The arguments are not evaluated when the
+ * level is compiled out.
+ */
+#define TRACE_AT(level, format, ...)                                          \
+    do {                                                                      \
+        if ((level) >= TRACE_LEVEL) {                                         \
+            static const char trace_format[] = format;                        \
+            trace_log().log((level), trace_format, ##__VA_ARGS__);            \
+        }                                                                     \
+    } while (0)
+
+/* Record a trace, up to 4 arguments, followed by up to TraceLog::MAX_DATA bytes of data. */
+#define TRACE_DUMP_AT(level, data, length, format, ...)                       \
+    do {                                                                      \
+        if ((level) >= TRACE_LEVEL) {                                         \
+            static const char trace_format[] = format;                        \
+            trace_log().dump((level), (data), (length), trace_format, ##__VA_ARGS__); \
+        }                                                                     \
+    } while (0)
+
+#define TRACE_DEBUG(...)   TRACE_AT(TRACE_LEVEL_DEBUG, __VA_ARGS__)
+#define TRACE_INFO(...)    TRACE_AT(TRACE_LEVEL_INFO, __VA_ARGS__)
+#define TRACE_WARNING(...) TRACE_AT(TRACE_LEVEL_WARNING, __VA_ARGS__)
+#define TRACE_ERROR(...)   TRACE_AT(TRACE_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * Tokenized binary trace buffered in RAM.
+ *
+ * A trace call does not format anything: it stores the address of its
+ * format string, a timestamp and its arguments as 32 bit words in a ring
+ * buffer, then returns. The ring is emptied on the serial port by drain(),
+ * from the idle hook, and the host rebuilds the messages with the string
+ * table extracted from the ELF file: every format is a static array named
+ * trace_format, see tools/trace_decode.py.
+ *
+ * A record is reserved with a compare and swap on the head, so traces can
+ * be recorded from any thread or interrupt without lock. Its first word,
+ * the format address, is written last: drain() stops on a record not yet
+ * complete. A record which does not fit is dropped and counted.
+ *
+ * Records in the ring:
+ *   word 0  format address
+ *   word 1  timestamp in us
+ *   word 2  level << 8 | arguments count | data length << 16
+ *   then the arguments and the data bytes, padded to a word
+ *
+ * On the serial port a record is sent as RECORD_MARKER, its word count,
+ * its words little endian and the sum of their bytes, so the decoder can
+ * tell records from console text.
+ */
+class TraceLog {
+public:
+    static const uint32_t SIZE = MBED_CONF_APP_TRACE_BUFFER_WORDS;
+    static const uint32_t MAX_DATA = 64;
+    static const uint8_t RECORD_MARKER = 0x1E;
+
+    void log(uint32_t level, const char *format)
+    {
+        write(level, format, NULL, 0, NULL, 0);
+    }
+
+    template<typename A0>
+    void log(uint32_t level, const char *format, A0 a0)
+    {
+        uint32_t args[] = { word(a0) };
+        write(level, format, args, 1, NULL, 0);
+    }
+
+    template<typename A0, typename A1>
+    void log(uint32_t level, const char *format, A0 a0, A1 a1)
+    {
+        uint32_t args[] = { word(a0), word(a1) };
+        write(level, format, args, 2, NULL, 0);
+    }
+
+    template<typename A0, typename A1, typename A2>
+    void log(uint32_t level, const char *format, A0 a0, A1 a1, A2 a2)
+    {
+        uint32_t args[] = { word(a0), word(a1), word(a2) };
+        write(level, format, args, 3, NULL, 0);
+    }
+
+    template<typename A0, typename A1, typename A2, typename A3>
+    void log(uint32_t level, const char *format, A0 a0, A1 a1, A2 a2, A3 a3)
+    {
+        uint32_t args[] = { word(a0), word(a1), word(a2), word(a3) };
+        write(level, format, args, 4, NULL, 0);
+    }
+
+    void dump(uint32_t level, const uint8_t *data, size_t length, const char *format)
+    {
+        write(level, format, NULL, 0, data, length);
+    }
+
+    template<typename A0>
+    void dump(uint32_t level, const uint8_t *data, size_t length, const char *format, A0 a0)
+    {
+        uint32_t args[] = { word(a0) };
+        write(level, format, args, 1, data, length);
+    }
+
+    template<typename A0, typename A1>
+    void dump(uint32_t level, const uint8_t *data, size_t length, const char *format, A0 a0, A1 a1)
+    {
+        uint32_t args[] = { word(a0), word(a1) };
+        write(level, format, args, 2, data, length);
+    }
+
+    template<typename A0, typename A1, typename A2>
+    void dump(uint32_t level, const uint8_t *data, size_t length, const char *format, A0 a0, A1 a1, A2 a2)
+    {
+        uint32_t args[] = { word(a0), word(a1), word(a2) };
+        write(level, format, args, 3, data, length);
+    }
+
+    template<typename A0, typename A1, typename A2, typename A3>
+    void dump(uint32_t level, const uint8_t *data, size_t length, const char *format, A0 a0, A1 a1, A2 a2, A3 a3)
+    {
+        uint32_t args[] = { word(a0), word(a1), word(a2), word(a3) };
+        write(level, format, args, 4, data, length);
+    }
+
+    /**
+     * Send the records on a serial port as long as it accepts bytes without
+     * waiting, a record can span several calls.
+     *
+     * @return true if records remain.
+     */
+    bool drain(mbed::RawSerial &serial)
+    {
+        while (serial.writeable()) {
+            if (!_tx_words) {
+                if (_tail == _head) {
+                    return false;
+                }
+
+                if (!_buffer[_tail & MASK]) {
+                    // reserved but not complete yet
+                    return true;
+                }
+
+                uint32_t header = _buffer[(_tail + 2) & MASK];
+                _tx_words = 3 + (header & 0xFF) + ((header >> 16) + 3) / 4;
+                _tx_byte = 0;
+                _tx_sum = 0;
+            }
+
+            serial.putc(next_byte());
+        }
+
+        return _tail != _head;
+    }
+
+    /** Records dropped because the ring was full. */
+    uint32_t dropped() const
+    {
+        return _dropped;
+    }
+
+private:
+    static const uint32_t MASK = SIZE - 1;
+
+    template<typename T>
+    static uint32_t word(T value)
+    {
+        return (uint32_t)value;
+    }
+
+    template<typename T>
+    static uint32_t word(T *pointer)
+    {
+        return (uint32_t)(uintptr_t)pointer;
+    }
+
+    void write(
+        uint32_t level, const char *format,
+        const uint32_t *args, uint32_t count,
+        const uint8_t *data, size_t length
+    ) {
+        if (length > MAX_DATA) {
+            length = MAX_DATA;
+        }
+
+        uint32_t size = 3 + count + (length + 3) / 4;
+        uint32_t head = _head;
+        do {
+            if (head - _tail + size > SIZE) {
+                core_util_atomic_incr_u32(&_dropped, 1);
+                return;
+            }
+        } while (!core_util_atomic_cas_u32(&_head, &head, head + size));
+
+        _buffer[(head + 1) & MASK] = us_ticker_read();
+        _buffer[(head + 2) & MASK] = (length << 16) | (level << 8) | count;
+
+        uint32_t index = head + 3;
+        for (uint32_t i = 0; i < count; ++i) {
+            _buffer[index++ & MASK] = args[i];
+        }
+
+        for (size_t i = 0; i < length; i += 4) {
+            uint32_t value = 0;
+            memcpy(&value, data + i, (length - i < 4) ? length - i : 4);
+            _buffer[index++ & MASK] = value;
+        }
+
+        // publish the record once it is complete
+        __DMB();
+        _buffer[head & MASK] = (uint32_t)(uintptr_t)format;
+    }
+
+    uint8_t next_byte()
+    {
+        uint32_t last = 2 + 4 * _tx_words;
+        uint32_t position = _tx_byte++;
+
+        if (position == 0) {
+            return RECORD_MARKER;
+        } else if (position == 1) {
+            return (uint8_t)_tx_words;
+        } else if (position < last) {
+            uint32_t offset = position - 2;
+            uint8_t byte = (uint8_t)(_buffer[(_tail + offset / 4) & MASK] >> (8 * (offset % 4)));
+            _tx_sum += byte;
+            return byte;
+        }
+
+        // checksum sent: release the record, a cleared first word marks
+        // the slots as not complete for the next lap
+        uint8_t sum = _tx_sum;
+        for (uint32_t i = 0; i < _tx_words; ++i) {
+            _buffer[(_tail + i) & MASK] = 0;
+        }
+        __DMB();
+        _tail += _tx_words;
+        _tx_words = 0;
+        return sum;
+    }
+
+    // zero initialized in static storage: no constructor runs
+    uint32_t _buffer[SIZE];
+    volatile uint32_t _head;
+    volatile uint32_t _tail;
+    volatile uint32_t _dropped;
+    uint32_t _tx_words;
+    uint32_t _tx_byte;
+    uint8_t _tx_sum;
+};
+
+// the ring indexes wrap with MASK
+MBED_STATIC_ASSERT(
+    TraceLog::SIZE && !(TraceLog::SIZE & (TraceLog::SIZE - 1)),
+    "trace_buffer_words must be a power of two"
+);
+
+/** The trace log of the application. */
+inline TraceLog &trace_log()
+{
+    static TraceLog log;
+    return log;
+}
+
+#endif /* GATT_EXAMPLE_TRACE_LOG_H_ */
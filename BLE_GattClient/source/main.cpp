@@ -16,11 +16,14 @@
  */
 
 #include <memory>
-#include <new>
 #include <stdio.h>
 
 #include "events/EventQueue.h"
 #include "platform/NonCopyable.h"
+#include "drivers/Timer.h"
+#include "drivers/RawSerial.h"
+#include "platform/mbed_sleep.h"
+#include "rtos/rtos_idle.h"
 
 #include "ble/BLE.h"
 #include "ble/Gap.h"
@@ -33,6 +36,54 @@
 #include "ble/CharacteristicDescriptorDiscovery.h"
 
 #include "BLEProcess.h"
+#include "DiscoveryCache.h"
+#include "NotificationDispatcher.h"
+#include "StreamAnalyzer.h"
+#include "TargetedDiscovery.h"
+#include "TraceLog.h"
+#include "CycleCounter.h"
+
+/* Skip the discovery of peers whose database is in the cache */
+static const bool DISCOVERY_CACHE = MBED_CONF_APP_DISCOVERY_CACHE;
+
+/* Subscribe before reading and skip the descriptor discovery of implied CCCDs */
+static const bool PIPELINED_CLIENT = MBED_CONF_APP_PIPELINED_CLIENT;
+
+/* Period of the notification rate report, 0 to disable */
+static const int NOTIFICATION_REPORT_MS = MBED_CONF_APP_NOTIFICATION_REPORT_MS;
+
+/* Print the value of every notification received */
+static const bool NOTIFICATION_ECHO = MBED_CONF_APP_NOTIFICATION_ECHO;
+
+/* Negotiate the ATT MTU before any other procedure */
+static const bool ATT_MTU_EXCHANGE = MBED_CONF_APP_ATT_MTU_EXCHANGE;
+
+/* Proceed without a larger MTU if the exchange does not complete in time */
+static const int ATT_MTU_TIMEOUT_MS = 1000;
+
+/* ATT MTU of a connection before the exchange */
+static const uint16_t DEFAULT_ATT_MTU = 23;
+
+/* Check the health of the BlueST sensor streams instead of printing them */
+static const bool STREAM_ANALYZER = MBED_CONF_APP_STREAM_ANALYZER;
+
+/* Compare the cost of a trace and of a printf at startup */
+static const bool TRACE_BENCHMARK = MBED_CONF_APP_TRACE_BENCHMARK;
+
+/* Capacity of the table of discovered characteristics */
+static const size_t MAX_CHARACTERISTICS = MBED_CONF_APP_MAX_CHARACTERISTICS;
+
+/* Discover the BlueST sensor streams only instead of the whole server */
+static const bool TARGETED_DISCOVERY = MBED_CONF_APP_TARGETED_DISCOVERY;
+
+/* Database Hash characteristic of the Generic Attribute service */
+static const uint16_t DATABASE_HASH_UUID = 0x2B2A;
+
+/* Generic Attribute service, holds the Database Hash and Service Changed */
+static const uint16_t GENERIC_ATTRIBUTE_UUID = 0x1801;
+
+/* BlueST service of BLE_STBlue2_Sensor */
+static const UUID bluest_service_uuid("00000000-0001-11e1-9ab4-0002a5d5c51b");
 
 /**
  * Handle discovery of the GATT server.
@@ -41,9 +92,25 @@
  * characteristic is read and the client register to characteristic
  * notifications or indication when available. The client report server
  * indications and notification until the connection end.
+ *
+ * The subscriptions made are saved in a DiscoveryCache. On the next
+ * connection of the same peer, once its Database Hash has been checked, the
+ * client writes the cached CCCDs directly and skips the discovery.
+ *
+ * Notifications and indications are routed to a handler per value handle
+ * by a NotificationDispatcher, which reports their rate periodically. The
+ * BlueST sensor streams are also checked by a StreamAnalyzer.
+ *
+ * When discovery targets are set, only those characteristics are searched
+ * by a TargetedDiscovery, which stops as soon as they are found.
+ *
+ * The ATT MTU is negotiated first. A read response carries up to MTU - 1
+ * bytes and the stack continues longer values with Read Blob requests, so
+ * the round trips of each read are derived from its length and the MTU.
  */
 class GattClientProcess : private mbed::NonCopyable<GattClientProcess>,
-                          public ble::Gap::EventHandler {
+                          public ble::Gap::EventHandler,
+                          public GattClient::EventHandler {
 
     // Internal typedef to this class type.
     // It is used as a shorthand to pass member function as callbacks.
@@ -57,6 +124,13 @@ class GattClientProcess : private mbed::NonCopyable<GattClientProcess>,
 
     typedef DiscoveredCharacteristic::Properties_t Properties_t;
 
+    // Passes over the characteristics discovered.
+    enum ProcessingPhase {
+        PHASE_WALK,
+        PHASE_SUBSCRIBE,
+        PHASE_READ
+    };
+
 public:
 
     /**
@@ -67,9 +141,24 @@ public:
     GattClientProcess() :
         _client(NULL),
         _connection_handle(),
-        _characteristics(NULL),
+        _characteristic_count(0),
         _it(NULL),
+        _phase(PHASE_WALK),
+        _att_procedures(0),
         _descriptor_handle(0),
+        _hash_handle(0),
+        _service_changed_handle(0),
+        _validating_cache(false),
+        _from_cache(false),
+        _cached_index(0),
+        _waiting_first_notification(false),
+        _att_mtu(DEFAULT_ATT_MTU),
+        _mtu_pending(false),
+        _mtu_timeout_id(0),
+        _mtu_sized_notifications(0),
+        _read_bytes(0),
+        _read_round_trips(0),
+        _read_round_trips_default_mtu(0),
         _ble_interface(NULL),
         _event_queue(NULL) {
     }
@@ -86,10 +175,31 @@ public:
         _client = &_ble_interface->gattClient();
 
         _ble_interface->gap().setEventHandler(this);
+        _client->setEventHandler(this);
+
+        if (NOTIFICATION_REPORT_MS) {
+            _event_queue->call_every(NOTIFICATION_REPORT_MS, this, &Self::report_notifications);
+        }
+
+        if (TRACE_BENCHMARK) {
+            benchmark_trace();
+        }
+    }
+
+    /**
+     * Restrict the discovery to a characteristic of a service, the others are
+     * ignored. Targets are kept across connections.
+     *
+     * @return false if there are too many targets.
+     */
+    bool add_discovery_target(const UUID &service, const UUID &characteristic)
+    {
+        return _targets.add(service, characteristic);
     }
 
     /**
-     * Start the discovery process.
+     * Start the discovery process, or restore the subscriptions from the
+     * discovery cache if the peer database has not changed.
      *
      * @param[in] client The GattClient instance which will discover the distant
      * GATT server.
@@ -101,24 +211,25 @@ public:
         // setup the event handlers called during the process
         _client->onDataWritten().add(as_cb(&Self::when_descriptor_written));
         _client->onHVX().add(as_cb(&Self::when_characteristic_changed));
+        _client->onDataRead().add(as_cb(&Self::when_hash_read));
 
-        // The discovery process will invoke when_service_discovered when a
-        // service is discovered, when_characteristic_discovered when a
-        // characteristic is discovered and when_service_discovery_ends once the
-        // discovery process has ended.
-        _client->onServiceDiscoveryTermination(as_cb(&Self::when_service_discovery_ends));
-        ble_error_t error = _client->launchServiceDiscovery(
-            _connection_handle,
-            as_cb(&Self::when_service_discovered),
-            as_cb(&Self::when_characteristic_discovered)
-        );
+        if (ATT_MTU_EXCHANGE) {
+            _att_procedures++;
+            ble_error_t error = _client->negotiateAttMtu(_connection_handle);
 
-        if (error) {
-            printf("Error %u returned by _client->launchServiceDiscovery.\r\n", error);
-            return;
+            if (!error) {
+                // the discovery starts once the MTU is known
+                _mtu_pending = true;
+                _mtu_timeout_id = _event_queue->call_in(
+                    ATT_MTU_TIMEOUT_MS, mbed::callback(this, &Self::when_mtu_timeout)
+                );
+                return;
+            }
+
+            printf("Error %u while negotiating the ATT MTU.\r\n", error);
         }
 
-        printf("Client process started: initiate service discovery.\r\n");
+        start_procedures();
     }
 
     /**
@@ -133,20 +244,115 @@ public:
         // unregister event handlers
         _client->onDataWritten().detach(as_cb(&Self::when_descriptor_written));
         _client->onHVX().detach(as_cb(&Self::when_characteristic_changed));
+        _client->onDataRead().detach(as_cb(&Self::when_hash_read));
         _client->onServiceDiscoveryTermination(NULL);
 
-        // remove discovered characteristics
-        clear_characteristics();
+        if (_mtu_pending) {
+            _event_queue->cancel(_mtu_timeout_id);
+        }
+
+        _targets.cancel();
 
         // clean up the instance
         _connection_handle = 0;
-        _characteristics = NULL;
+        _characteristic_count = 0;
         _it = NULL;
+        _phase = PHASE_WALK;
+        _att_procedures = 0;
         _descriptor_handle = 0;
+        _hash_handle = 0;
+        _service_changed_handle = 0;
+        _validating_cache = false;
+        _from_cache = false;
+        _cached_index = 0;
+        _waiting_first_notification = false;
+        _connection_timer.stop();
+        _dispatcher.clear();
+        _analyzer.clear();
+        _att_mtu = DEFAULT_ATT_MTU;
+        _mtu_pending = false;
+        _mtu_sized_notifications = 0;
+        _read_bytes = 0;
+        _read_round_trips = 0;
+        _read_round_trips_default_mtu = 0;
 
         printf("Client process stopped.\r\n");
     }
 
+private:
+    /**
+     * Restore the subscriptions from the discovery cache or discover the
+     * server.
+     */
+    void start_procedures()
+    {
+        if (DISCOVERY_CACHE && _cache.load()) {
+            validate_cache();
+            return;
+        }
+
+        launch_discovery();
+    }
+
+    /**
+     * Launch the discovery of the services and characteristics of the server.
+     */
+    void launch_discovery()
+    {
+        _characteristic_count = 0;
+        _it = NULL;
+        _dispatcher.clear();
+        _analyzer.clear();
+        _cache.clear();
+        _hash_handle = 0;
+        _service_changed_handle = 0;
+
+        if (_targets.count()) {
+            launch_targeted_discovery();
+            return;
+        }
+
+        // The discovery process will invoke when_service_discovered when a
+        // service is discovered, when_characteristic_discovered when a
+        // characteristic is discovered and when_service_discovery_ends once the
+        // discovery process has ended.
+        _client->onServiceDiscoveryTermination(as_cb(&Self::when_service_discovery_ends));
+        ble_error_t error = _client->launchServiceDiscovery(
+            _connection_handle,
+            as_cb(&Self::when_service_discovered),
+            as_cb(&Self::when_characteristic_discovered)
+        );
+
+        if (error) {
+            printf("Error %u returned by _client->launchServiceDiscovery.\r\n", error);
+            return;
+        }
+
+        printf("Client process started: initiate service discovery.\r\n");
+    }
+
+    /**
+     * Discover the targets only; when_characteristic_discovered is invoked
+     * for each target found and when_targeted_discovery_ends at the end.
+     */
+    void launch_targeted_discovery()
+    {
+        ble_error_t error = _targets.launch(
+            *_client,
+            *_event_queue,
+            _connection_handle,
+            mbed::callback(this, &Self::when_characteristic_discovered),
+            mbed::callback(this, &Self::when_targeted_discovery_ends)
+        );
+
+        if (error) {
+            printf("Error %u returned by the targeted discovery.\r\n", error);
+            return;
+        }
+
+        printf("Client process started: initiate the discovery of %u targets.\r\n", _targets.count());
+    }
+
 private:
     /**
      * Event handler invoked when a connection is established.
@@ -157,6 +363,13 @@ private:
     virtual void onConnectionComplete(const ble::ConnectionCompleteEvent &event)
     {
         _connection_handle = event.getConnectionHandle();
+        _cache.select(event.getPeerAddress());
+
+        // measure the time from connection to the first notification
+        _connection_timer.reset();
+        _connection_timer.start();
+        _waiting_first_notification = true;
+
         _event_queue->call(mbed::callback(this, &Self::start));
     }
 
@@ -170,7 +383,48 @@ private:
         }
     }
 
-private:
+////////////////////////////////////////////////////////////////////////////////
+// ATT MTU exchange.
+
+    /**
+     * Event handler invoked when the ATT MTU of a connection changes.
+     *
+     * The exchange started by start() completes here, the procedures waiting
+     * for it are then started.
+     */
+    virtual void onAttMtuChange(ble::connection_handle_t connection_handle, uint16_t att_mtu)
+    {
+        if (connection_handle != _connection_handle) {
+            return;
+        }
+
+        _att_mtu = att_mtu;
+        printf(
+            "ATT MTU %u: reads up to %u bytes per round trip, notifications up to %u bytes.\r\n",
+            _att_mtu, _att_mtu - 1, _att_mtu - 3
+        );
+
+        if (_mtu_pending) {
+            _mtu_pending = false;
+            _event_queue->cancel(_mtu_timeout_id);
+            start_procedures();
+        }
+    }
+
+    /**
+     * The peer did not answer the exchange or kept the MTU unchanged.
+     */
+    void when_mtu_timeout()
+    {
+        if (!_mtu_pending) {
+            return;
+        }
+
+        _mtu_pending = false;
+        printf("ATT MTU exchange not completed, proceed with an MTU of %u.\r\n", _att_mtu);
+        start_procedures();
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
 // Service and characteristic discovery process.
 
@@ -214,10 +468,19 @@ private:
             discovered_characteristic->getLastHandle()
         );
 
-        // add the characteristic into the list of discovered characteristics
+        // remember the characteristics used to validate the discovery cache
+        const UUID &uuid = discovered_characteristic->getUUID();
+        if (uuid == DATABASE_HASH_UUID) {
+            _hash_handle = discovered_characteristic->getValueHandle();
+        } else if (uuid == GattCharacteristic::UUID_SERVICE_CHANGED_CHAR) {
+            _service_changed_handle = discovered_characteristic->getValueHandle();
+            _cache.set_service_changed_handle(_service_changed_handle);
+        }
+
+        // add the characteristic into the table of discovered characteristics
         bool success = add_characteristic(discovered_characteristic);
         if (!success) {
-            printf("Error: memory allocation failure while adding the discovered characteristic.\r\n");
+            printf("Error: more than %u characteristics discovered.\r\n", MAX_CHARACTERISTICS);
             _client->terminateServiceDiscovery();
             stop();
             return;
@@ -234,7 +497,7 @@ private:
      */
     void when_service_discovery_ends(Gap::Handle_t connection_handle)
     {
-        if (!_characteristics) {
+        if (!_characteristic_count) {
             printf("No characteristics discovered, end of the process.\r\n");
             return;
         }
@@ -243,47 +506,196 @@ private:
 
         // reset iterator and start processing characteristics in order
         _it = NULL;
+        _phase = PIPELINED_CLIENT ? PHASE_SUBSCRIBE : PHASE_WALK;
         _event_queue->call(mbed::callback(this, &Self::process_next_characteristic));
     }
 
+    /**
+     * Handle the end of the targeted discovery, the characteristics found
+     * are then processed like after a full discovery.
+     */
+    void when_targeted_discovery_ends(ble::connection_handle_t connection_handle)
+    {
+        printf(
+            "Targeted discovery: %u of %u targets found in %u service searches, %d ms after the connection.\r\n",
+            _targets.resolved(), _targets.count(), _targets.searches(), _connection_timer.read_ms()
+        );
+        _att_procedures += _targets.searches();
+
+        when_service_discovery_ends(connection_handle);
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
 // Processing of characteristics based on their properties.
 
     /**
      * Process the characteristics discovered.
      *
+     * The sequential walker (PHASE_WALK) takes the characteristics one by one:
      * - If the characteristic is readable then read its value and print it. Then
      * - If the characteristic can emit notification or indication then discover
      * the characteristic CCCD and subscribe to the server initiated event.
      * - Otherwise skip the characteristic processing.
+     *
+     * The pipelined client makes two passes instead. PHASE_SUBSCRIBE writes
+     * the CCCDs first, so the client is ready for notifications as soon as
+     * possible, then PHASE_READ reads the readable characteristics.
      */
     void process_next_characteristic(void)
     {
         if (!_it) {
             _it = _characteristics;
         } else {
-            _it = _it->next;
+            ++_it;
         }
 
-        while (_it) {
-            Properties_t properties = _it->value.getProperties();
-
-            if (properties.read()) {
-                read_characteristic(_it->value);
+        for (; _it != _characteristics + _characteristic_count; ++_it) {
+            Properties_t properties = _it->getProperties();
+            bool subscribe = properties.notify() || properties.indicate();
+
+            if (_phase == PHASE_SUBSCRIBE) {
+                if (subscribe) {
+                    subscribe_characteristic(*_it);
+                    return;
+                }
+            } else if (_phase == PHASE_READ) {
+                if (properties.read()) {
+                    read_characteristic(*_it);
+                    return;
+                }
+            } else if (properties.read()) {
+                read_characteristic(*_it);
                 return;
-            } else if(properties.notify() || properties.indicate()) {
-                discover_descriptors(_it->value);
+            } else if (subscribe) {
+                discover_descriptors(*_it);
                 return;
             } else {
                 printf(
                     "Skip processing of characteristic %u\r\n",
-                    _it->value.getValueHandle()
+                    _it->getValueHandle()
                 );
-                _it = _it->next;
             }
         }
 
-        printf("All characteristics discovered have been processed.\r\n");
+        if (_phase == PHASE_SUBSCRIBE) {
+            report_ready();
+            _phase = PHASE_READ;
+            _it = NULL;
+            process_next_characteristic();
+            return;
+        }
+
+        if (_phase == PHASE_WALK) {
+            report_ready();
+        }
+
+        printf(
+            "All characteristics discovered have been processed: %d ms after the connection, %u ATT procedures.\r\n",
+            _connection_timer.read_ms(), _att_procedures
+        );
+
+        if (_read_round_trips) {
+            printf(
+                "Reads: %lu bytes in %lu round trips at an MTU of %u, %lu at the default MTU.\r\n",
+                (unsigned long)_read_bytes, (unsigned long)_read_round_trips,
+                _att_mtu, (unsigned long)_read_round_trips_default_mtu
+            );
+        }
+
+        if (!DISCOVERY_CACHE) {
+            return;
+        }
+
+        if (_cache.save()) {
+            printf("Discovery cache: %u subscriptions saved.\r\n", _cache.count());
+        } else {
+            printf("Discovery cache: not saved, no database hash or too many subscriptions.\r\n");
+        }
+    }
+
+    /**
+     * Print the time from the connection until all subscriptions are made.
+     */
+    void report_ready()
+    {
+        printf(
+            "Ready for notifications %d ms after the connection, %u ATT procedures (%s).\r\n",
+            _connection_timer.read_ms(), _att_procedures,
+            _from_cache ? "discovery cache" : PIPELINED_CLIENT ? "pipelined client" : "sequential walker"
+        );
+    }
+
+////////////////////////////////////////////////////////////////////////////////
+// Reconnection from the discovery cache.
+
+    /**
+     * Read the Database Hash at its cached handle, when_hash_read compares it
+     * with the cached value.
+     */
+    void validate_cache()
+    {
+        printf("Discovery cache: validate the database hash at %u.\r\n", _cache.hash_handle());
+
+        _validating_cache = true;
+        _att_procedures++;
+        ble_error_t error = _client->read(_connection_handle, _cache.hash_handle(), 0);
+
+        if (error) {
+            printf("Error %u while reading the database hash, discover the server.\r\n", error);
+            _validating_cache = false;
+            _cache.invalidate();
+            launch_discovery();
+        }
+    }
+
+    /**
+     * Use the cached subscriptions if the database hash has not changed,
+     * otherwise drop the entry and discover the server.
+     */
+    void when_hash_read(const GattReadCallbackParams *read_event)
+    {
+        if (!_validating_cache || read_event->handle != _cache.hash_handle()) {
+            return;
+        }
+        _validating_cache = false;
+
+        if (read_event->status != BLE_ERROR_NONE ||
+            !_cache.hash_matches(read_event->data, read_event->len)) {
+            printf("Discovery cache: database changed, discover the server.\r\n");
+            _cache.invalidate();
+            launch_discovery();
+            return;
+        }
+
+        printf("Discovery cache: database unchanged, restore %u subscriptions.\r\n", _cache.count());
+        _service_changed_handle = _cache.service_changed_handle();
+        _from_cache = true;
+        _cached_index = 0;
+        subscribe_next_cached();
+    }
+
+    /**
+     * Write the next cached CCCD; the completion is handled by
+     * when_descriptor_written().
+     */
+    void subscribe_next_cached()
+    {
+        if (_cached_index == _cache.count()) {
+            printf("All cached subscriptions have been restored.\r\n");
+            report_ready();
+            return;
+        }
+
+        const DiscoveryCache::Subscription &subscription =
+            _cache.subscription(_cached_index++);
+
+        printf("Subscribe to %u from the cache.\r\n", subscription.value_handle);
+        register_handler(
+            subscription.value_handle,
+            static_cast<StreamAnalyzer::StreamKind>(subscription.tag)
+        );
+        _descriptor_handle = subscription.cccd_handle;
+        write_cccd(subscription.cccd_value);
     }
 
     /**
@@ -294,6 +706,9 @@ private:
     void read_characteristic(const DiscoveredCharacteristic &characteristic)
     {
         printf("Initiating read at %u.\r\n", characteristic.getValueHandle());
+        _att_procedures++;
+        _read_timer.reset();
+        _read_timer.start();
         ble_error_t error = characteristic.read(
             0, as_cb(&Self::when_characteristic_read)
         );
@@ -310,28 +725,77 @@ private:
     /**
      * Handle the reception of a read response.
      *
-     * If the characteristic can emit notification or indication then start the
-     * discovery of the the characteristic descriptors then subscribe to the
-     * server initiated event by writing the CCCD discovered. Otherwise start
-     * the processing of the next characteristic discovered in the server.
+     * In the sequential walker, if the characteristic can emit notification or
+     * indication then start the discovery of the the characteristic descriptors
+     * then subscribe to the server initiated event by writing the CCCD
+     * discovered. Otherwise start the processing of the next characteristic
+     * discovered in the server.
      */
     void when_characteristic_read(const GattReadCallbackParams *read_event)
     {
-        printf("\tCharacteristic value at %u equal to: ", read_event->handle);
-        for (size_t i = 0; i <  read_event->len; ++i) {
-            printf("0x%02X ", read_event->data[i]);
+        TRACE_DUMP_AT(
+            TRACE_LEVEL_INFO, read_event->data, read_event->len,
+            "\tCharacteristic value at %u equal to: ", read_event->handle
+        );
+
+        account_read(read_event->len);
+
+        if (read_event->handle == _hash_handle) {
+            _cache.set_hash(_hash_handle, read_event->data, read_event->len);
         }
-        printf(".\r\n");
 
-        Properties_t properties = _it->value.getProperties();
+        Properties_t properties = _it->getProperties();
 
-        if(properties.notify() || properties.indicate()) {
-            discover_descriptors(_it->value);
+        if (_phase == PHASE_WALK && (properties.notify() || properties.indicate())) {
+            discover_descriptors(*_it);
         } else {
             process_next_characteristic();
         }
     }
 
+    /**
+     * Account the round trips of a read: the Read Response and the Read Blob
+     * Responses which follow carry MTU - 1 bytes each until the last, shorter
+     * one.
+     */
+    void account_read(size_t length)
+    {
+        _read_timer.stop();
+
+        unsigned round_trips = length / (_att_mtu - 1) + 1;
+        unsigned round_trips_default_mtu = length / (DEFAULT_ATT_MTU - 1) + 1;
+
+        _read_bytes += length;
+        _read_round_trips += round_trips;
+        _read_round_trips_default_mtu += round_trips_default_mtu;
+
+        if (round_trips > 1 || round_trips_default_mtu > 1) {
+            TRACE_INFO(
+                "\tLong read of %u bytes: %u round trips in %d ms, %u at the default MTU.",
+                length, round_trips, _read_timer.read_ms(), round_trips_default_mtu
+            );
+        }
+    }
+
+    /**
+     * Subscribe to a characteristic in the pipelined client.
+     *
+     * A characteristic that notifies or indicates shall have a CCCD. When its
+     * handle range holds a single descriptor, that descriptor is the CCCD and
+     * is written without a descriptor discovery round trip.
+     */
+    void subscribe_characteristic(const DiscoveredCharacteristic &characteristic)
+    {
+        if (characteristic.getLastHandle() != characteristic.getValueHandle() + 1) {
+            discover_descriptors(characteristic);
+            return;
+        }
+
+        _descriptor_handle = characteristic.getLastHandle();
+        printf("\tCCCD of %u implied at %u.\r\n", characteristic.getValueHandle(), _descriptor_handle);
+        subscribe_to_cccd();
+    }
+
     /**
      * Initiate the discovery of the descriptors of the characteristic in input.
      *
@@ -343,6 +807,7 @@ private:
         printf("Initiating descriptor discovery of %u.\r\n", characteristic.getValueHandle());
 
         _descriptor_handle = 0;
+        _att_procedures++;
         ble_error_t error = characteristic.discoverDescriptors(
             as_cb(&Self::when_descriptor_discovered),
             as_cb(&Self::when_descriptor_discovery_ends)
@@ -391,11 +856,34 @@ private:
             return;
         }
 
-        Properties_t properties = _it->value.getProperties();
+        subscribe_to_cccd();
+    }
+
+    /**
+     * Write the CCCD at _descriptor_handle for the current characteristic and
+     * record the subscription in the discovery cache.
+     */
+    void subscribe_to_cccd()
+    {
+        Properties_t properties = _it->getProperties();
 
         uint16_t cccd_value =
             (properties.notify() << 0) | (properties.indicate() << 1);
 
+        StreamAnalyzer::StreamKind stream = StreamAnalyzer::kind_of(_it->getUUID());
+
+        _cache.add(_it->getValueHandle(), _descriptor_handle, cccd_value, stream);
+        register_handler(_it->getValueHandle(), stream);
+        write_cccd(cccd_value);
+    }
+
+    /**
+     * Subscribe to server initiated events by writing the CCCD at
+     * _descriptor_handle.
+     */
+    void write_cccd(uint16_t cccd_value)
+    {
+        _att_procedures++;
         ble_error_t error = _client->write(
             GattClient::GATT_OP_WRITE_REQ,
             _connection_handle,
@@ -425,13 +913,18 @@ private:
             return;
         }
 
-        printf("\tCCCD at %u written.\r\n", _descriptor_handle);
+        TRACE_INFO("\tCCCD at %u written.", _descriptor_handle);
         _descriptor_handle = 0;
-        process_next_characteristic();
+
+        if (_from_cache) {
+            subscribe_next_cached();
+        } else {
+            process_next_characteristic();
+        }
     }
 
     /**
-     * Print the updated value of the characteristic.
+     * Route the updated value of the characteristic to its handler.
      *
      * This function is called when the server emits a notification or an
      * indication of a characteristic value the client has subscribed to.
@@ -440,59 +933,184 @@ private:
      */
     void when_characteristic_changed(const GattHVXCallbackParams* event)
     {
-        printf("Change on attribute %u: new value = ", event->handle);
-        for (size_t i = 0; i < event->len; ++i) {
-            printf("0x%02X ", event->data[i]);
+        if (_service_changed_handle && event->handle == _service_changed_handle) {
+            // handles of this connection may be stale, the next one discovers
+            printf("Service changed indication: discovery cache entry dropped.\r\n");
+            _cache.invalidate();
+        } else if (_waiting_first_notification) {
+            _waiting_first_notification = false;
+            printf(
+                "First notification %d ms after the connection (%s).\r\n",
+                _connection_timer.read_ms(),
+                _from_cache ? "discovery cache" : "full discovery"
+            );
+        }
+
+        // the server truncates values longer than the notification payload
+        if (event->len == _att_mtu - 3) {
+            _mtu_sized_notifications++;
+        }
+
+        if (!_dispatcher.dispatch(event)) {
+            TRACE_WARNING("Change on attribute %u without subscription.", event->handle);
+        }
+    }
+
+    /**
+     * Route the notifications of a characteristic subscribed to
+     * when_value_notified(), or to when_stream_notified() for a BlueST
+     * sensor stream.
+     */
+    void register_handler(GattAttribute::Handle_t value_handle, StreamAnalyzer::StreamKind stream)
+    {
+        bool analyzed = STREAM_ANALYZER && _analyzer.add(value_handle, stream);
+
+        bool success = _dispatcher.subscribe(
+            value_handle,
+            analyzed ?
+                mbed::callback(this, &Self::when_stream_notified) :
+                mbed::callback(this, &Self::when_value_notified)
+        );
+
+        if (!success) {
+            printf("Warning: notifications of %u are not dispatched, table full.\r\n", value_handle);
         }
-        printf(".\r\n");
     }
 
-    struct DiscoveredCharacteristicNode {
-        DiscoveredCharacteristicNode(const DiscoveredCharacteristic &c) :
-            value(c), next(NULL) { }
+    /**
+     * Handle the value of a characteristic subscribed to.
+     *
+     * The value is only printed on demand: at high notification rates the
+     * console would be the bottleneck. The span is valid during the call.
+     */
+    void when_value_notified(GattAttribute::Handle_t handle, mbed::Span<const uint8_t> value)
+    {
+        if (!NOTIFICATION_ECHO) {
+            return;
+        }
 
-        DiscoveredCharacteristic value;
-        DiscoveredCharacteristicNode *next;
-    };
+        if (find_characteristic(handle)) {
+            TRACE_DUMP_AT(
+                TRACE_LEVEL_INFO, value.data(), value.size(),
+                "Change on characteristic at %u: new value = ", handle
+            );
+        } else {
+            TRACE_DUMP_AT(
+                TRACE_LEVEL_INFO, value.data(), value.size(),
+                "Change on attribute %u: new value = ", handle
+            );
+        }
+    }
 
     /**
-     * Add a discovered characteristic into the list of discovered characteristics.
+     * Handle the value of a BlueST sensor stream: it is accounted by the
+     * analyzer, which prints a summary with every report.
      */
-    bool add_characteristic(const DiscoveredCharacteristic *characteristic)
+    void when_stream_notified(GattAttribute::Handle_t handle, mbed::Span<const uint8_t> value)
     {
-        DiscoveredCharacteristicNode* new_node =
-            new(std::nothrow) DiscoveredCharacteristicNode(*characteristic);
+        _analyzer.analyze(handle, value);
+        when_value_notified(handle, value);
+    }
 
-        if (new_node == false) {
-            printf("Error while allocating a new characteristic.\r\n");
+    /**
+     * Print the notification rates of the subscribed characteristics and
+     * the health of the sensor streams.
+     */
+    void report_notifications()
+    {
+        if (_dispatcher.count()) {
+            _dispatcher.report();
+        }
+
+        if (_mtu_sized_notifications) {
+            printf(
+                "%lu notifications filled the ATT MTU of %u, their values may be truncated.\r\n",
+                (unsigned long)_mtu_sized_notifications, _att_mtu
+            );
+            _mtu_sized_notifications = 0;
+        }
+
+        if (_analyzer.count()) {
+            _analyzer.report();
+        }
+    }
+
+    /**
+     * Print the cycles spent in a trace call and in a printf of the same
+     * message; the printf waits for the console.
+     */
+    void benchmark_trace()
+    {
+        static const unsigned CALLS = 8;
+        CycleCounter::enable();
+
+        uint32_t start = CycleCounter::read();
+        for (unsigned i = 0; i < CALLS; ++i) {
+            TRACE_INFO("Benchmark %u of %u.", i, CALLS);
+        }
+        uint32_t trace_cycles = (CycleCounter::read() - start) / CALLS;
+
+        start = CycleCounter::read();
+        for (unsigned i = 0; i < CALLS; ++i) {
+            printf("Benchmark %u of %u.\r\n", i, CALLS);
+        }
+        uint32_t printf_cycles = (CycleCounter::read() - start) / CALLS;
+
+        printf(
+            "Trace: %lu cycles per call, printf: %lu cycles per call.\r\n",
+            (unsigned long)trace_cycles, (unsigned long)printf_cycles
+        );
+    }
+
+    /**
+     * Add a discovered characteristic into the table, kept sorted by value
+     * handle.
+     *
+     * The server reports characteristics in handle order, the insertion is
+     * then an append.
+     */
+    bool add_characteristic(const DiscoveredCharacteristic *characteristic)
+    {
+        if (_characteristic_count == MAX_CHARACTERISTICS) {
             return false;
         }
 
-        if (_characteristics == NULL) {
-            _characteristics = new_node;
-        } else {
-            DiscoveredCharacteristicNode* c = _characteristics;
-            while(c->next) {
-                c = c->next;
-            }
-            c->next = new_node;
+        GattAttribute::Handle_t handle = characteristic->getValueHandle();
+        size_t position = _characteristic_count;
+        while (position && _characteristics[position - 1].getValueHandle() > handle) {
+            _characteristics[position] = _characteristics[position - 1];
+            --position;
         }
 
+        _characteristics[position] = *characteristic;
+        ++_characteristic_count;
         return true;
     }
 
     /**
-     * Clear the list of discovered characteristics.
+     * Find a discovered characteristic from its value handle.
+     *
+     * @return The characteristic or NULL if the handle is not in the table.
      */
-    void clear_characteristics(void)
+    const DiscoveredCharacteristic *find_characteristic(GattAttribute::Handle_t handle) const
     {
-        DiscoveredCharacteristicNode *c= _characteristics;
+        size_t low = 0;
+        size_t high = _characteristic_count;
 
-        while (c) {
-            DiscoveredCharacteristicNode *n = c->next;
-            delete c;
-            c = n;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            GattAttribute::Handle_t middle_handle = _characteristics[middle].getValueHandle();
+
+            if (middle_handle == handle) {
+                return &_characteristics[middle];
+            } else if (middle_handle < handle) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
         }
+
+        return NULL;
     }
 
     /**
@@ -548,20 +1166,82 @@ private:
 
     GattClient *_client;
     Gap::Handle_t _connection_handle;
-    DiscoveredCharacteristicNode *_characteristics;
-    DiscoveredCharacteristicNode *_it;
+    DiscoveredCharacteristic _characteristics[MAX_CHARACTERISTICS];
+    size_t _characteristic_count;
+    DiscoveredCharacteristic *_it;
+    ProcessingPhase _phase;
+    unsigned _att_procedures;
     GattAttribute::Handle_t _descriptor_handle;
+    GattAttribute::Handle_t _hash_handle;
+    GattAttribute::Handle_t _service_changed_handle;
+    DiscoveryCache _cache;
+    bool _validating_cache;
+    bool _from_cache;
+    size_t _cached_index;
+    mbed::Timer _connection_timer;
+    bool _waiting_first_notification;
+    uint16_t _att_mtu;
+    bool _mtu_pending;
+    int _mtu_timeout_id;
+    uint32_t _mtu_sized_notifications;
+    mbed::Timer _read_timer;
+    uint32_t _read_bytes;
+    uint32_t _read_round_trips;
+    uint32_t _read_round_trips_default_mtu;
+    TargetedDiscovery _targets;
+    NotificationDispatcher _dispatcher;
+    StreamAnalyzer _analyzer;
     BLE *_ble_interface;
     events::EventQueue *_event_queue;
 };
 
 
+/* Console on which the traces are sent, next to the printf output */
+static mbed::RawSerial trace_serial(USBTX, USBRX, MBED_CONF_PLATFORM_STDIO_BAUD_RATE);
+
+/**
+ * Idle hook: send the traces while the serial port accepts bytes, sleep
+ * until the next interrupt once they are all sent.
+ *
+ * It replaces the default hook of mbed OS, which nothing else locks deep
+ * sleep for: the sleep is kept shallow here, so that the kernel tick keeps
+ * running and the last bytes still shifting out of the UART are not lost.
+ * A tickless kernel is not suspended either, it wakes on every tick.
+ */
+static void drain_trace()
+{
+    if (!trace_log().drain(trace_serial)) {
+        core_util_critical_section_enter();
+        sleep_manager_lock_deep_sleep();
+        sleep();
+        sleep_manager_unlock_deep_sleep();
+        core_util_critical_section_exit();
+    }
+}
+
 int main() {
 
     BLE &ble_interface = BLE::Instance();
     events::EventQueue event_queue;
     BLEProcess ble_process(event_queue, ble_interface);
-    GattClientProcess gatt_client_process;
+    // static, the characteristic table is too large for the main stack
+    static GattClientProcess gatt_client_process;
+
+    if (TARGETED_DISCOVERY) {
+        gatt_client_process.add_discovery_target(bluest_service_uuid, bluest_env_uuid);
+        gatt_client_process.add_discovery_target(bluest_service_uuid, bluest_imu_uuid);
+        gatt_client_process.add_discovery_target(bluest_service_uuid, bluest_quat_uuid);
+
+        if (DISCOVERY_CACHE) {
+            // the cache needs the database hash and service changed handles
+            gatt_client_process.add_discovery_target(
+                GENERIC_ATTRIBUTE_UUID, DATABASE_HASH_UUID
+            );
+            gatt_client_process.add_discovery_target(
+                GENERIC_ATTRIBUTE_UUID, GattCharacteristic::UUID_SERVICE_CHANGED_CHAR
+            );
+        }
+    }
 
     // Register GattClientProcess::init in the ble_process; this function will
     // be called once the ble_interface is initialized.
@@ -569,6 +1249,9 @@ int main() {
         mbed::callback(&gatt_client_process, &GattClientProcess::init)
     );
 
+    // traces are sent when there is nothing else to do
+    rtos_attach_idle_hook(drain_trace);
+
     // bind the event queue to the ble interface, initialize the interface
     // and start advertising
     ble_process.start();
@@ -30,6 +30,8 @@
 #include "ble/GapAdvertisingData.h"
 #include "ble/FunctionPointerWithContext.h"
 
+#include "BLEEventPump.h"
+
 /**
  * Handle initialization adn shutdown of the BLE Instance.
  *
@@ -45,6 +47,7 @@ public:
      */
     BLEProcess(events::EventQueue &event_queue, BLE &ble_interface) :
         _event_queue(event_queue),
+        _event_pump(event_queue),
         _ble_interface(ble_interface),
         _post_init_cb() {
     }
@@ -78,7 +81,7 @@ public:
         }
 
         _ble_interface.onEventsToProcess(
-            makeFunctionPointer(this, &BLEProcess::schedule_ble_events)
+            makeFunctionPointer(&_event_pump, &BLEEventPump::schedule)
         );
 
         ble_error_t error = _ble_interface.init(
@@ -106,14 +109,6 @@ public:
 
 private:
 
-    /**
-     * Schedule processing of events from the BLE middleware in the event queue.
-     */
-    void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *event)
-    {
-        _event_queue.call(mbed::callback(&event->ble, &BLE::processEvents));
-    }
-
     /**
      * Sets up adverting payload and start advertising.
      *
@@ -154,6 +149,7 @@ private:
     void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
     {
         printf("Disconnected.\r\n");
+        _event_pump.print();
         start_advertising();
     }
 
@@ -199,6 +195,7 @@ private:
     }
 
     events::EventQueue &_event_queue;
+    BLEEventPump _event_pump;
     BLE &_ble_interface;
     mbed::Callback<void(BLE&, events::EventQueue&)> _post_init_cb;
 };
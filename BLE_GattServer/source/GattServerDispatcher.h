@@ -0,0 +1,228 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_SERVER_EXAMPLE_GATT_SERVER_DISPATCHER_H_
+#define GATT_SERVER_EXAMPLE_GATT_SERVER_DISPATCHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform/NonCopyable.h"
+
+#include "ble/GattServer.h"
+#include "ble/GattService.h"
+#include "ble/GattCharacteristic.h"
+#include "ble/GattCallbackParamTypes.h"
+
+/**
+ * Route the GattServer events to the service owning the attribute.
+ *
+ * The GattServer reports reads, writes, subscriptions and confirmations of
+ * every attribute to the same callbacks, which then have to compare the
+ * handle with the value handle of each characteristic. The dispatcher
+ * registers those callbacks once and keeps a table indexed by value handle,
+ * filled when a service is added: an event reaches the handler of its
+ * service with the index of the characteristic in the service, in constant
+ * time whatever the number of characteristics.
+ *
+ * The table covers MAX_HANDLES attribute handles from the first service
+ * added.
+ */
+template<size_t MAX_HANDLES>
+class GattServerDispatcher : private mbed::NonCopyable<GattServerDispatcher<MAX_HANDLES> > {
+    typedef GattServerDispatcher Self;
+
+public:
+    /**
+     * Events of the characteristics of a service, index is the position of
+     * the characteristic in the service.
+     */
+    class EventHandler {
+    public:
+        virtual void when_data_written(size_t index, const GattWriteCallbackParams *e) { }
+
+        virtual void when_data_read(size_t index, const GattReadCallbackParams *e) { }
+
+        /** The reply is left to success when not overridden. */
+        virtual void authorize_client_write(size_t index, GattWriteAuthCallbackParams *e) { }
+
+        /** The reply is left to success when not overridden. */
+        virtual void authorize_client_read(size_t index, GattReadAuthCallbackParams *e) { }
+
+        virtual void when_update_enabled(size_t index) { }
+
+        virtual void when_update_disabled(size_t index) { }
+
+        virtual void when_confirmation_received(size_t index) { }
+
+    protected:
+        ~EventHandler() { }
+    };
+
+    /* Authorizations requested for the characteristics of a service */
+    enum Authorization {
+        AUTHORIZE_NONE = 0,
+        AUTHORIZE_READ = 1 << 0,
+        AUTHORIZE_WRITE = 1 << 1
+    };
+
+    GattServerDispatcher() :
+        _server(NULL),
+        _first_handle(0)
+    {
+        for (size_t i = 0; i < MAX_HANDLES; ++i) {
+            _entries[i].handler = NULL;
+            _entries[i].index = 0;
+        }
+    }
+
+    /**
+     * Register a service in the server and route the events of its
+     * characteristics to handler.
+     *
+     * @param authorization Authorizations handled by handler, a combination
+     * of Authorization values, applied to every characteristic.
+     */
+    ble_error_t add_service(
+        GattServer &server,
+        GattService &service,
+        EventHandler &handler,
+        uint8_t authorization = AUTHORIZE_NONE
+    ) {
+        if (_server && _server != &server) {
+            return BLE_ERROR_INVALID_PARAM;
+        }
+
+        // the stack reads the authorization flags when the service is added
+        for (size_t i = 0; i < service.getCharacteristicCount(); ++i) {
+            GattCharacteristic *characteristic = service.getCharacteristic(i);
+            if (authorization & AUTHORIZE_READ) {
+                characteristic->setReadAuthorizationCallback(this, &Self::authorize_client_read);
+            }
+            if (authorization & AUTHORIZE_WRITE) {
+                characteristic->setWriteAuthorizationCallback(this, &Self::authorize_client_write);
+            }
+        }
+
+        ble_error_t error = server.addService(service);
+        if (error) {
+            return error;
+        }
+
+        if (!_server) {
+            attach(server, service.getHandle());
+        }
+
+        for (size_t i = 0; i < service.getCharacteristicCount(); ++i) {
+            Entry *entry = find(service.getCharacteristic(i)->getValueHandle());
+            if (!entry) {
+                return BLE_ERROR_NO_MEM;
+            }
+            entry->handler = &handler;
+            entry->index = i;
+        }
+
+        return BLE_ERROR_NONE;
+    }
+
+private:
+    struct Entry {
+        EventHandler *handler;
+        uint8_t index;
+    };
+
+    void attach(GattServer &server, GattAttribute::Handle_t first_handle)
+    {
+        _server = &server;
+        _first_handle = first_handle;
+
+        _server->onDataWritten(this, &Self::when_data_written);
+        _server->onDataRead(this, &Self::when_data_read);
+        _server->onUpdatesEnabled(makeFunctionPointer(this, &Self::when_update_enabled));
+        _server->onUpdatesDisabled(makeFunctionPointer(this, &Self::when_update_disabled));
+        _server->onConfirmationReceived(makeFunctionPointer(this, &Self::when_confirmation_received));
+    }
+
+    Entry *find(GattAttribute::Handle_t handle)
+    {
+        if (handle < _first_handle || (size_t)(handle - _first_handle) >= MAX_HANDLES) {
+            return NULL;
+        }
+        return &_entries[handle - _first_handle];
+    }
+
+    void when_data_written(const GattWriteCallbackParams *e)
+    {
+        Entry *entry = find(e->handle);
+        if (entry && entry->handler) {
+            entry->handler->when_data_written(entry->index, e);
+        }
+    }
+
+    void when_data_read(const GattReadCallbackParams *e)
+    {
+        Entry *entry = find(e->handle);
+        if (entry && entry->handler) {
+            entry->handler->when_data_read(entry->index, e);
+        }
+    }
+
+    void authorize_client_write(GattWriteAuthCallbackParams *e)
+    {
+        Entry *entry = find(e->handle);
+        if (entry && entry->handler) {
+            entry->handler->authorize_client_write(entry->index, e);
+        }
+    }
+
+    void authorize_client_read(GattReadAuthCallbackParams *e)
+    {
+        Entry *entry = find(e->handle);
+        if (entry && entry->handler) {
+            entry->handler->authorize_client_read(entry->index, e);
+        }
+    }
+
+    void when_update_enabled(GattAttribute::Handle_t handle)
+    {
+        Entry *entry = find(handle);
+        if (entry && entry->handler) {
+            entry->handler->when_update_enabled(entry->index);
+        }
+    }
+
+    void when_update_disabled(GattAttribute::Handle_t handle)
+    {
+        Entry *entry = find(handle);
+        if (entry && entry->handler) {
+            entry->handler->when_update_disabled(entry->index);
+        }
+    }
+
+    void when_confirmation_received(GattAttribute::Handle_t handle)
+    {
+        Entry *entry = find(handle);
+        if (entry && entry->handler) {
+            entry->handler->when_confirmation_received(entry->index);
+        }
+    }
+
+    GattServer *_server;
+    GattAttribute::Handle_t _first_handle;
+    Entry _entries[MAX_HANDLES];
+};
+
+#endif /* GATT_SERVER_EXAMPLE_GATT_SERVER_DISPATCHER_H_ */
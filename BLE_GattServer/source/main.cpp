@@ -19,6 +19,11 @@
 #include "platform/Callback.h"
 #include "events/EventQueue.h"
 #include "platform/NonCopyable.h"
+#include "platform/mbed_sleep.h"
+#include "drivers/RawSerial.h"
+#include "rtos/rtos_idle.h"
+#include "rtos/Kernel.h"
+#include "hal/us_ticker_api.h"
 
 #include "ble/BLE.h"
 #include "ble/Gap.h"
@@ -27,46 +32,67 @@
 #include "ble/GapAdvertisingData.h"
 #include "ble/GattServer.h"
 #include "BLEProcess.h"
+#include "TraceLog.h"
+#include "GattServerDispatcher.h"
+#include "GattServiceTable.h"
 
 using mbed::callback;
 
+/* Attribute handles covered by the dispatch table, from the first service */
+static const size_t MAX_ATTRIBUTE_HANDLES = 32;
+
+typedef GattServerDispatcher<MAX_ATTRIBUTE_HANDLES> Dispatcher;
+
+/* Clock service, "51311102-030e-485f-b122-f8f381aa84ed" */
+static const UUID::LongUUIDBytes_t clock_service_uuid =
+    GATT_UUID128(0x51311102, 0x030e, 0x485f, 0xb122, 0xf8f3, 0x81aa84ed);
+
 /**
  * A Clock service that demonstrate the GattServer features.
  *
  * The clock service host three characteristics that model the current hour,
- * minute and second of the clock. The value of the second characteristic is
- * incremented automatically by the system.
+ * minute and second of the clock. The clock is an offset applied to the
+ * kernel millisecond count, which keeps running in sleep from the low power
+ * ticker: the characteristic values are computed when a client reads them,
+ * from the read authorization handler, and nothing runs periodically.
  *
  * A client can subscribe to updates of the clock characteristics and get
- * notified when one of the value is changed. Clients can also change value of
- * the second, minute and hour characteristric.
+ * notified when one of the value is changed. The service then wakes up at the
+ * next change of the finest field subscribed and notifies the subscribed
+ * fields that changed only. Clients can also change value of the second,
+ * minute and hour characteristric.
+ *
+ * The characteristics are declared in a constant table kept in flash. The
+ * events of the characteristics are routed by the dispatcher, with the
+ * index of the characteristic which is also the clock field it holds.
  */
-class ClockService {
+class ClockService : private Dispatcher::EventHandler {
     typedef ClockService Self;
 
+    enum Field {
+        HOUR = 0,
+        MINUTE,
+        SECOND,
+        FIELD_COUNT
+    };
+
+    static const uint32_t SECOND_MS = 1000;
+    static const uint32_t MINUTE_MS = 60 * SECOND_MS;
+    static const uint32_t HOUR_MS = 60 * MINUTE_MS;
+    static const uint32_t DAY_MS = 24 * HOUR_MS;
+
 public:
-    ClockService() :
-        _hour_char("485f4145-52b9-4644-af1f-7a6b9322490f", 0),
-        _minute_char("0a924ca7-87cd-4699-a3bd-abdcd9cf126a", 0),
-        _second_char("8dd6a1b7-bc75-4741-8a26-264af75807de", 0),
-        _clock_service(
-            /* uuid */ "51311102-030e-485f-b122-f8f381aa84ed",
-            /* characteristics */ _clock_characteristics,
-            /* numCharacteristics */ sizeof(_clock_characteristics) /
-                                     sizeof(_clock_characteristics[0])
-        ),
+    ClockService(Dispatcher &dispatcher) :
+        _dispatcher(dispatcher),
         _server(NULL),
-        _event_queue(NULL)
+        _event_queue(NULL),
+        _offset_ms(0),
+        _subscriptions(0),
+        _update_id(0)
     {
-        // update internal pointers (value, descriptors and characteristics array)
-        _clock_characteristics[0] = &_hour_char;
-        _clock_characteristics[1] = &_minute_char;
-        _clock_characteristics[2] = &_second_char;
-
-        // setup authorization handlers
-        _hour_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
-        _minute_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
-        _second_char.setWriteAuthorizationCallback(this, &Self::authorize_client_write);
+        for (size_t field = 0; field < FIELD_COUNT; ++field) {
+            _values[field] = 0;
+        }
     }
 
 
@@ -80,33 +106,46 @@ public:
         _server = &ble_interface.gattServer();
         _event_queue = &event_queue;
 
-        // register the service
+        // register the service, reads and writes are authorized by the
+        // handlers of this service
         printf("Adding demo service\r\n");
-        ble_error_t err = _server->addService(_clock_service);
+        uint8_t *const values[FIELD_COUNT] = {
+            &_values[HOUR], &_values[MINUTE], &_values[SECOND]
+        };
+        GattService &service = _table.build(clock_service_uuid, definitions(), values);
+
+        uint32_t start_us = us_ticker_read();
+        ble_error_t err = _dispatcher.add_service(
+            *_server,
+            service,
+            *this,
+            Dispatcher::AUTHORIZE_READ | Dispatcher::AUTHORIZE_WRITE
+        );
+        uint32_t setup_us = us_ticker_read() - start_us;
 
         if (err) {
             printf("Error %u during demo service registration.\r\n", err);
             return;
         }
 
-        // read write handler
+        // the other events are routed by the dispatcher
         _server->onDataSent(as_cb(&Self::when_data_sent));
-        _server->onDataWritten(as_cb(&Self::when_data_written));
-        _server->onDataRead(as_cb(&Self::when_data_read));
 
-        // updates subscribtion handlers
-        _server->onUpdatesEnabled(as_cb(&Self::when_update_enabled));
-        _server->onUpdatesDisabled(as_cb(&Self::when_update_disabled));
-        _server->onConfirmationReceived(as_cb(&Self::when_confirmation_received));
+        // subscriptions end with the connection
+        ble_interface.gap().onDisconnection(this, &Self::when_disconnection);
 
         // print the handles
-        printf("clock service registered\r\n");
-        printf("service handle: %u\r\n", _clock_service.getHandle());
-        printf("\thour characteristic value handle %u\r\n", _hour_char.getValueHandle());
-        printf("\tminute characteristic value handle %u\r\n", _minute_char.getValueHandle());
-        printf("\tsecond characteristic value handle %u\r\n", _second_char.getValueHandle());
-
-        _event_queue->call_every(1000 /* ms */, callback(this, &Self::increment_second));
+        printf(
+            "clock service registered in %lu us, %u bytes of RAM\r\n",
+            (unsigned long)setup_us, (unsigned)sizeof(ClockService)
+        );
+        printf("service handle: %u\r\n", service.getHandle());
+        printf("\thour characteristic value handle %u\r\n", _table.value_handle(HOUR));
+        printf("\tminute characteristic value handle %u\r\n", _table.value_handle(MINUTE));
+        printf("\tsecond characteristic value handle %u\r\n", _table.value_handle(SECOND));
+
+        // the clock starts at 00:00:00
+        set_clock(0);
     }
 
 private:
@@ -116,87 +155,71 @@ private:
      */
     void when_data_sent(unsigned count)
     {
-        printf("sent %u updates\r\n", count);
+        TRACE_DEBUG("sent %u updates", count);
     }
 
     /**
      * Handler called after an attribute has been written.
      */
-    void when_data_written(const GattWriteCallbackParams *e)
+    void when_data_written(size_t field, const GattWriteCallbackParams *e)
     {
-        printf("data written:\r\n");
-        printf("\tconnection handle: %u\r\n", e->connHandle);
-        printf("\tattribute handle: %u", e->handle);
-        if (e->handle == _hour_char.getValueHandle()) {
-            printf(" (hour characteristic)\r\n");
-        } else if (e->handle == _minute_char.getValueHandle()) {
-            printf(" (minute characteristic)\r\n");
-        } else if (e->handle == _second_char.getValueHandle()) {
-            printf(" (second characteristic)\r\n");
-        } else {
-            printf("\r\n");
-        }
-        printf("\twrite operation: %u\r\n", e->writeOp);
-        printf("\toffset: %u\r\n", e->offset);
-        printf("\tlength: %u\r\n", e->len);
-        printf("\t data: ");
-
-        for (size_t i = 0; i < e->len; ++i) {
-            printf("%02X", e->data[i]);
-        }
-
-        printf("\r\n");
+        TRACE_DUMP_AT(
+            TRACE_LEVEL_INFO, e->data, e->len,
+            "data written: attribute %u (%s), operation %u, offset %u:",
+            e->handle, field_name(field), e->writeOp, e->offset
+        );
     }
 
     /**
      * Handler called after an attribute has been read.
      */
-    void when_data_read(const GattReadCallbackParams *e)
+    void when_data_read(size_t field, const GattReadCallbackParams *e)
     {
-        printf("data read:\r\n");
-        printf("\tconnection handle: %u\r\n", e->connHandle);
-        printf("\tattribute handle: %u", e->handle);
-        if (e->handle == _hour_char.getValueHandle()) {
-            printf(" (hour characteristic)\r\n");
-        } else if (e->handle == _minute_char.getValueHandle()) {
-            printf(" (minute characteristic)\r\n");
-        } else if (e->handle == _second_char.getValueHandle()) {
-            printf(" (second characteristic)\r\n");
-        } else {
-            printf("\r\n");
-        }
+        TRACE_INFO(
+            "data read: connection %u, attribute %u (%s)",
+            e->connHandle, e->handle, field_name(field)
+        );
     }
 
     /**
      * Handler called after a client has subscribed to notification or indication.
      *
-     * @param handle Handle of the characteristic value affected by the change.
+     * @param field Field of the characteristic affected by the change.
      */
-    void when_update_enabled(GattAttribute::Handle_t handle)
+    void when_update_enabled(size_t field)
     {
-        printf("update enabled on handle %d\r\n", handle);
+        TRACE_INFO("update enabled on %s", field_name(field));
+
+        uint8_t values[FIELD_COUNT];
+        read_clock(values);
+        _notified[field] = values[field];
+        _subscriptions |= 1 << field;
+        schedule_update();
     }
 
     /**
      * Handler called after a client has cancelled his subscription from
      * notification or indication.
      *
-     * @param handle Handle of the characteristic value affected by the change.
+     * @param field Field of the characteristic affected by the change.
      */
-    void when_update_disabled(GattAttribute::Handle_t handle)
+    void when_update_disabled(size_t field)
     {
-        printf("update disabled on handle %d\r\n", handle);
+        TRACE_INFO("update disabled on %s", field_name(field));
+
+        _subscriptions &= ~(1 << field);
+        schedule_update();
     }
 
     /**
      * Handler called when an indication confirmation has been received.
      *
-     * @param handle Handle of the characteristic value that has emitted the
+     * @param field Field of the characteristic that has emitted the
      * indication.
      */
-    void when_confirmation_received(GattAttribute::Handle_t handle)
+    void when_confirmation_received(size_t field)
     {
-        printf("confirmation received on handle %d\r\n", handle);
+        TRACE_DEBUG("confirmation received on %s", field_name(field));
     }
 
     /**
@@ -205,104 +228,169 @@ private:
      * This handler verify that the value submitted by the client is valid before
      * authorizing the operation.
      */
-    void authorize_client_write(GattWriteAuthCallbackParams *e)
+    void authorize_client_write(size_t field, GattWriteAuthCallbackParams *e)
     {
-        printf("characteristic %u write authorization\r\n", e->handle);
+        TRACE_DEBUG("characteristic %u write authorization", e->handle);
 
         if (e->offset != 0) {
-            printf("Error invalid offset\r\n");
+            TRACE_WARNING("Error invalid offset %u on %u", e->offset, e->handle);
             e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET;
             return;
         }
 
         if (e->len != 1) {
-            printf("Error invalid len\r\n");
+            TRACE_WARNING("Error invalid len %u on %u", e->len, e->handle);
             e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_ATT_VAL_LENGTH;
             return;
         }
 
         if ((e->data[0] >= 60) ||
-            ((e->data[0] >= 24) && (e->handle == _hour_char.getValueHandle()))) {
-            printf("Error invalid data\r\n");
+            ((e->data[0] >= 24) && (field == HOUR))) {
+            TRACE_WARNING("Error invalid data %u on %u", e->data[0], e->handle);
             e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_WRITE_NOT_PERMITTED;
             return;
         }
 
+        // move the clock, the seconds keep their fraction
+        uint8_t values[FIELD_COUNT];
+        uint32_t now_ms = read_clock(values);
+        values[field] = e->data[0];
+        set_clock(
+            values[HOUR] * HOUR_MS + values[MINUTE] * MINUTE_MS +
+            values[SECOND] * SECOND_MS + now_ms % SECOND_MS
+        );
+
+        // the subscribers see the fields changed by the write
+        if (_subscriptions) {
+            _event_queue->call(this, &Self::update_subscribers);
+        }
+
         e->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
     }
 
     /**
-     * Increment the second counter.
+     * Handler called when a read request is received.
+     *
+     * The value returned to the client is computed from the clock at the time
+     * of the read, the attribute value in the database is not used.
      */
-    void increment_second(void)
+    void authorize_client_read(size_t field, GattReadAuthCallbackParams *e)
     {
-        uint8_t second = 0;
-        ble_error_t err = _second_char.get(*_server, second);
-        if (err) {
-            printf("read of the second value returned error %u\r\n", err);
+        if (e->offset != 0) {
+            e->authorizationReply = AUTH_CALLBACK_REPLY_ATTERR_INVALID_OFFSET;
             return;
         }
 
-        second = (second + 1) % 60;
+        // the stack reads the value after the handler returns
+        read_clock(_read_values);
+        e->data = &_read_values[field];
+        e->len = sizeof(_read_values[field]);
+        e->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+    }
 
-        err = _second_char.set(*_server, second);
-        if (err) {
-            printf("write of the second value returned error %u\r\n", err);
-            return;
-        }
+    /**
+     * Handler called when the connection is closed, its subscriptions end.
+     */
+    void when_disconnection(const Gap::DisconnectionCallbackParams_t *event)
+    {
+        _subscriptions = 0;
+        schedule_update();
+    }
 
-        if (second == 0) {
-            increment_minute();
-        }
+    /**
+     * Time of the day in milliseconds, split in fields in values.
+     */
+    uint32_t read_clock(uint8_t values[FIELD_COUNT]) const
+    {
+        uint32_t now_ms = (uint32_t)((rtos::Kernel::get_ms_count() + _offset_ms) % DAY_MS);
+        values[HOUR] = now_ms / HOUR_MS;
+        values[MINUTE] = (now_ms / MINUTE_MS) % 60;
+        values[SECOND] = (now_ms / SECOND_MS) % 60;
+        return now_ms;
     }
 
     /**
-     * Increment the minute counter.
+     * Set the time of the day, in milliseconds.
      */
-    void increment_minute(void)
+    void set_clock(uint32_t time_ms)
     {
-        uint8_t minute = 0;
-        ble_error_t err = _minute_char.get(*_server, minute);
-        if (err) {
-            printf("read of the minute value returned error %u\r\n", err);
-            return;
-        }
+        uint32_t elapsed_ms = (uint32_t)(rtos::Kernel::get_ms_count() % DAY_MS);
+        _offset_ms = (time_ms + DAY_MS - elapsed_ms) % DAY_MS;
+    }
 
-        minute = (minute + 1) % 60;
+    /**
+     * Wake up at the next change of the finest field subscribed, or not at
+     * all without subscription.
+     */
+    void schedule_update()
+    {
+        if (_update_id) {
+            _event_queue->cancel(_update_id);
+            _update_id = 0;
+        }
 
-        err = _minute_char.set(*_server, minute);
-        if (err) {
-            printf("write of the minute value returned error %u\r\n", err);
+        if (!_subscriptions) {
             return;
         }
 
-        if (minute == 0) {
-            increment_hour();
+        uint32_t period_ms = HOUR_MS;
+        if (_subscriptions & (1 << SECOND)) {
+            period_ms = SECOND_MS;
+        } else if (_subscriptions & (1 << MINUTE)) {
+            period_ms = MINUTE_MS;
         }
+
+        uint8_t values[FIELD_COUNT];
+        uint32_t now_ms = read_clock(values);
+        _update_id = _event_queue->call_in(
+            period_ms - now_ms % period_ms, this, &Self::update_subscribers
+        );
     }
 
     /**
-     * Increment the hour counter.
+     * Notify the subscribed fields which changed since their last update.
      */
-    void increment_hour(void)
+    void update_subscribers()
     {
-        uint8_t hour = 0;
-        ble_error_t err = _hour_char.get(*_server, hour);
-        if (err) {
-            printf("read of the hour value returned error %u\r\n", err);
-            return;
+        _update_id = 0;
+
+        uint8_t values[FIELD_COUNT];
+        read_clock(values);
+
+        for (int field = 0; field < FIELD_COUNT; ++field) {
+            if (!(_subscriptions & (1 << field)) || values[field] == _notified[field]) {
+                continue;
+            }
+
+            ble_error_t err = _server->write(
+                _table.value_handle(field),
+                &values[field],
+                sizeof(values[field])
+            );
+            if (err) {
+                TRACE_ERROR("update of %u returned error %u", field, err);
+            }
+            _notified[field] = values[field];
         }
 
-        hour = (hour + 1) % 24;
-
-        err = _hour_char.set(*_server, hour);
-        if (err) {
-            printf("write of the hour value returned error %u\r\n", err);
-            return;
-        }
+        schedule_update();
     }
 
 private:
+    /**
+     * Name of the characteristic of a clock field, the string stays in flash
+     * where the trace decoder reads it.
+     */
+    static const char *field_name(size_t field)
+    {
+        static const char *const names[FIELD_COUNT] = {
+            "hour characteristic",
+            "minute characteristic",
+            "second characteristic"
+        };
+        return field < (size_t)FIELD_COUNT ? names[field] : "other";
+    }
+
     /**
      * Helper that construct an event handler from a member function of this
      * instance.
@@ -314,92 +402,93 @@ private:
     }
 
     /**
-     * Read, Write, Notify, Indicate  Characteristic declaration helper.
-     *
-     * @tparam T type of data held by the characteristic.
+     * Definitions of the clock characteristics, in the order of the fields.
+     * Constant initialized: the table is in flash and costs no startup code.
      */
-    template<typename T>
-    class ReadWriteNotifyIndicateCharacteristic : public GattCharacteristic {
-    public:
-        /**
-         * Construct a characteristic that can be read or written and emit
-         * notification or indication.
-         *
-         * @param[in] uuid The UUID of the characteristic.
-         * @param[in] initial_value Initial value contained by the characteristic.
-         */
-        ReadWriteNotifyIndicateCharacteristic(const UUID & uuid, const T& initial_value) :
-            GattCharacteristic(
-                /* UUID */ uuid,
-                /* Initial value */ &_value,
-                /* Value size */ sizeof(_value),
-                /* Value capacity */ sizeof(_value),
-                /* Properties */ GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
-                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE,
-                /* Descriptors */ NULL,
-                /* Num descriptors */ 0,
-                /* variable len */ false
-            ),
-            _value(initial_value) {
-        }
+    static const GattCharacteristicDef (&definitions())[FIELD_COUNT]
+    {
+        static const uint8_t properties =
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
+            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE;
+
+        static const GattCharacteristicDef table[FIELD_COUNT] = {
+            /* hour, "485f4145-52b9-4644-af1f-7a6b9322490f" */ {
+                GATT_UUID128(0x485f4145, 0x52b9, 0x4644, 0xaf1f, 0x7a6b, 0x9322490f),
+                sizeof(uint8_t), properties, false
+            },
+            /* minute, "0a924ca7-87cd-4699-a3bd-abdcd9cf126a" */ {
+                GATT_UUID128(0x0a924ca7, 0x87cd, 0x4699, 0xa3bd, 0xabdc, 0xd9cf126a),
+                sizeof(uint8_t), properties, false
+            },
+            /* second, "8dd6a1b7-bc75-4741-8a26-264af75807de" */ {
+                GATT_UUID128(0x8dd6a1b7, 0xbc75, 0x4741, 0x8a26, 0x264a, 0xf75807de),
+                sizeof(uint8_t), properties, false
+            }
+        };
+        return table;
+    }
 
-        /**
-         * Get the value of this characteristic.
-         *
-         * @param[in] server GattServer instance that contain the characteristic
-         * value.
-         * @param[in] dst Variable that will receive the characteristic value.
-         *
-         * @return BLE_ERROR_NONE in case of success or an appropriate error code.
-         */
-        ble_error_t get(GattServer &server, T& dst) const
-        {
-            uint16_t value_length = sizeof(dst);
-            return server.read(getValueHandle(), &dst, &value_length);
-        }
+    // the clock characteristics, indexed by field, and the service
+    GattServiceTable<FIELD_COUNT> _table;
 
-        /**
-         * Assign a new value to this characteristic.
-         *
-         * @param[in] server GattServer instance that will receive the new value.
-         * @param[in] value The new value to set.
-         * @param[in] local_only Flag that determine if the change should be kept
-         * locally or forwarded to subscribed clients.
-         */
-        ble_error_t set(
-            GattServer &server, const uint8_t &value, bool local_only = false
-        ) const {
-            return server.write(getValueHandle(), &value, sizeof(value), local_only);
-        }
+    // values of the characteristics in the database, reads are authorized
+    // with the values of the clock instead
+    uint8_t _values[FIELD_COUNT];
 
-    private:
-        uint8_t _value;
-    };
+    Dispatcher &_dispatcher;
+    GattServer* _server;
+    events::EventQueue *_event_queue;
 
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _hour_char;
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _minute_char;
-    ReadWriteNotifyIndicateCharacteristic<uint8_t> _second_char;
+    // clock time minus the kernel time, in milliseconds
+    uint32_t _offset_ms;
 
-    // list of the characteristics of the clock service
-    GattCharacteristic* _clock_characteristics[3];
+    // fields returned to the last read
+    uint8_t _read_values[FIELD_COUNT];
 
-    // demo service
-    GattService _clock_service;
+    // fields subscribed, one bit per field, and their last value notified
+    uint8_t _subscriptions;
+    uint8_t _notified[FIELD_COUNT];
 
-    GattServer* _server;
-    events::EventQueue *_event_queue;
+    int _update_id;
 };
 
+/* Console on which the traces are sent, next to the printf output */
+static mbed::RawSerial trace_serial(USBTX, USBRX, MBED_CONF_PLATFORM_STDIO_BAUD_RATE);
+
+/**
+ * Idle hook: send the traces while the serial port accepts bytes, sleep
+ * until the next interrupt once they are all sent.
+ *
+ * It replaces the default hook of mbed OS, which nothing else locks deep
+ * sleep for: the sleep is kept shallow here, so that the kernel tick keeps
+ * running and the last bytes still shifting out of the UART are not lost.
+ * A tickless kernel is not suspended either, it wakes on every tick.
+ */
+static void drain_trace()
+{
+    if (!trace_log().drain(trace_serial)) {
+        core_util_critical_section_enter();
+        sleep_manager_lock_deep_sleep();
+        sleep();
+        sleep_manager_unlock_deep_sleep();
+        core_util_critical_section_exit();
+    }
+}
+
 int main() {
     BLE &ble_interface = BLE::Instance();
     events::EventQueue event_queue;
-    ClockService demo_service;
+    Dispatcher dispatcher;
+    ClockService demo_service(dispatcher);
     BLEProcess ble_process(event_queue, ble_interface);
 
     ble_process.on_init(callback(&demo_service, &ClockService::start));
 
+    // traces are sent when there is nothing else to do
+    rtos_attach_idle_hook(drain_trace);
+
     // bind the event queue to the ble interface, initialize the interface
     // and start advertising
     ble_process.start();
@@ -0,0 +1,199 @@
+#!/usr/bin/env python
+"""Decode the binary traces recorded by source/TraceLog.h.
+
+The traces only hold the address of their format string: the string table
+is generated from the ELF file of the application, where every format is a
+static array named trace_format. It can be saved with --save-table and
+reused with --table when the ELF is not at hand; the saved table also holds
+the read-only data the %s arguments point to.
+
+The serial output mixes console text and records: a record is 0x1E, its
+word count, its words little endian and the sum of their bytes. Text is
+printed as it is and records are printed as:
+
+    [   12.345678] I message
+"""
+
+import argparse
+import base64
+import json
+import re
+import struct
+import sys
+
+RECORD_MARKER = 0x1E
+LEVELS = 'DIWE'
+SPECIFIER = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|t)?([diouxXcsp%])')
+
+
+def read_table(elf_path):
+    """Map the address of every trace format to its string."""
+    from elftools.elf.elffile import ELFFile
+
+    table = {}
+    strings = {}
+    with open(elf_path, 'rb') as f:
+        elf = ELFFile(f)
+        sections = [s for s in elf.iter_sections() if s['sh_addr'] and s['sh_type'] == 'SHT_PROGBITS']
+        symbols = elf.get_section_by_name('.symtab')
+        for symbol in symbols.iter_symbols():
+            if 'trace_format' not in symbol.name or not symbol['st_size']:
+                continue
+            address = symbol['st_value']
+            for section in sections:
+                start = section['sh_addr']
+                if start <= address < start + section['sh_size']:
+                    data = section.data()[address - start:address - start + symbol['st_size']]
+                    table[address] = data.split(b'\0')[0].decode('ascii', 'replace')
+        # %s arguments point to constant strings, keep the read-only data
+        for section in sections:
+            if section['sh_flags'] & 0x1 == 0:  # not writable
+                strings[section['sh_addr']] = section.data()
+    return table, strings
+
+
+def save_table(path, table, strings):
+    with open(path, 'w') as f:
+        json.dump({
+            'formats': dict(('0x%08x' % k, v) for k, v in sorted(table.items())),
+            'strings': dict(('0x%08x' % k, base64.b64encode(v).decode('ascii'))
+                            for k, v in sorted(strings.items())),
+        }, f, indent=1)
+
+
+def load_table(path):
+    with open(path) as f:
+        saved = json.load(f)
+    table = dict((int(k, 0), v) for k, v in saved['formats'].items())
+    strings = dict((int(k, 0), base64.b64decode(v)) for k, v in saved['strings'].items())
+    return table, strings
+
+
+def c_string(strings, address):
+    for start, data in strings.items():
+        if start <= address < start + len(data):
+            return data[address - start:].split(b'\0')[0].decode('ascii', 'replace')
+    return '<0x%08x>' % address
+
+
+def format_message(fmt, args, strings):
+    args = list(args)
+
+    def convert(match):
+        flags, kind = match.groups()
+        if kind == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if kind in 'di':
+            value = struct.unpack('<i', struct.pack('<I', value))[0]
+        elif kind == 'c':
+            return chr(value & 0xFF)
+        elif kind == 's':
+            return c_string(strings, value)
+        elif kind == 'p':
+            return '0x%08x' % value
+        return ('%' + flags + kind) % value
+
+    return SPECIFIER.sub(convert, fmt)
+
+
+def decode(stream, table, strings, out):
+    """Split a byte stream into console text and records."""
+    data = bytearray()
+    at_line_start = True
+    lost = 0
+    epoch = 0
+    last_time = None
+
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            break
+        data += chunk
+
+        while data:
+            if data[0] != RECORD_MARKER:
+                end = data.find(bytearray([RECORD_MARKER]))
+                end = len(data) if end < 0 else end
+                text = data[:end].decode('ascii', 'replace')
+                out.write(text)
+                at_line_start = text.endswith('\n')
+                del data[:end]
+                continue
+
+            if len(data) < 2:
+                break
+            size = 2 + 4 * data[1] + 1
+            if len(data) < size:
+                break
+
+            words = struct.unpack_from('<%dI' % data[1], data, 2)
+            valid = (data[1] >= 3 and sum(data[2:size - 1]) & 0xFF == data[size - 1]
+                     and words[0] in table)
+            if not valid:
+                lost += 1
+                del data[:1]
+                continue
+
+            time = words[1]
+            if last_time is not None and time < last_time:
+                epoch += 1 << 32
+            last_time = time
+
+            header = words[2]
+            count = header & 0xFF
+            level = (header >> 8) & 0xFF
+            length = header >> 16
+            message = format_message(table[words[0]], words[3:3 + count], strings)
+            if length:
+                raw = struct.pack('<%dI' % (len(words) - 3 - count), *words[3 + count:])
+                message += ' '.join('%02X' % b for b in bytearray(raw[:length]))
+
+            if not at_line_start:
+                out.write('\n')
+                at_line_start = True
+            out.write('[%12.6f] %s %s\n' % ((epoch + time) / 1e6,
+                                           LEVELS[level] if level < len(LEVELS) else '?',
+                                           message.rstrip('\r\n')))
+            del data[:size]
+
+    # a record cut by the end of the capture
+    out.write(data.decode('ascii', 'replace'))
+
+    if lost:
+        sys.stderr.write('%d bytes looked like records but were not\n' % lost)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', help='capture of the serial port or a serial device, "-" for stdin')
+    parser.add_argument('--elf', help='ELF file of the application')
+    parser.add_argument('--table', help='string table saved by --save-table')
+    parser.add_argument('--save-table', help='write the string table generated from the ELF')
+    parser.add_argument('--baud', type=int, default=115200,
+                        help='baud rate when reading a serial device')
+    args = parser.parse_args()
+
+    if args.elf:
+        table, strings = read_table(args.elf)
+    elif args.table:
+        table, strings = load_table(args.table)
+    else:
+        parser.error('--elf or --table is needed')
+
+    if args.save_table:
+        save_table(args.save_table, table, strings)
+
+    if args.input == '-':
+        source = sys.stdin.buffer
+    elif args.input.startswith('/dev/') or args.input.startswith('COM'):
+        import serial
+        source = serial.Serial(args.input, args.baud)
+    else:
+        source = open(args.input, 'rb')
+
+    decode(source, table, strings, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -49,11 +49,23 @@ void update_led_characteristic(void) {
     }
 }
 
+/* The LED characteristic is known: end the discovery without waiting for the
+ * rest of the service or other instances of it, then read the LED. */
+void terminate_discovery(void) {
+    BLE::Instance().gattClient().terminateServiceDiscovery();
+    if (trigger_led_characteristic) {
+        trigger_led_characteristic = false;
+        update_led_characteristic();
+    }
+}
+
 void characteristic_discovery(const DiscoveredCharacteristic *characteristicP) {
     printf("  C UUID-%x valueAttr[%u] props[%x]\r\n", characteristicP->getUUID().getShortUUID(), characteristicP->getValueHandle(), (uint8_t)characteristicP->getProperties().broadcast());
     if (characteristicP->getUUID().getShortUUID() == 0xa001) { /* !ALERT! Alter this filter to suit your device. */
         led_characteristic        = *characteristicP;
         trigger_led_characteristic = true;
+        /* not from the discovery callback, the stack is running it */
+        event_queue.call(terminate_discovery);
     }
 }
 
@@ -367,7 +367,8 @@ LSM6DS3::LSM6DS3( uint8_t busType, uint8_t inputArg ) : LSM6DS3Core( busType, in
     //FIFO control data
     settings.fifoThreshold = 3000;  //Can be 0 to 4096 (16 bit bytes)
     settings.fifoSampleRate = 10;  //default 10Hz
-    settings.fifoModeWord = 0;  //Default off
+    settings.fifoModeWord = 6;  //Continuous mode.  Can be: 0 (bypass), 1 (FIFO), 3 (stream-to-FIFO), 4 (bypass-to-continuous), 6 (continuous)
+    settings.fifoStopOnThreshold = 0;  //Set to limit the FIFO depth to fifoThreshold
 
     allOnesCounter = 0;
     nonSuccessCounter = 0;
@@ -805,8 +806,16 @@ void LSM6DS3::fifoBegin( void )
             tempFIFO_CTRL5 |= LSM6DS3_ACC_GYRO_ODR_FIFO_6600Hz;
             break;
     }
-    //Hard code the fifo mode here:
-    tempFIFO_CTRL5 |= settings.fifoModeWord = 6;  //set mode:
+    //Set the fifo mode
+    tempFIFO_CTRL5 |= settings.fifoModeWord & 0x07;
+
+    //Limit the FIFO depth to the threshold if requested (CTRL4_C)
+    uint8_t tempCTRL4_C;
+    readRegister(&tempCTRL4_C, LSM6DS3_ACC_GYRO_CTRL4_C);
+    tempCTRL4_C &= ~((uint8_t)LSM6DS3_ACC_GYRO_STOP_ON_FTH_ENABLED);
+    if (settings.fifoStopOnThreshold == 1) {
+        tempCTRL4_C |= LSM6DS3_ACC_GYRO_STOP_ON_FTH_ENABLED;
+    }
 
     //Write the data
     writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL1, thresholdLByte);
@@ -815,6 +824,7 @@ void LSM6DS3::fifoBegin( void )
     //Serial.println(thresholdHByte, HEX);
     writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL3, tempFIFO_CTRL3);
     writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL4, tempFIFO_CTRL4);
+    writeRegister(LSM6DS3_ACC_GYRO_CTRL4_C, tempCTRL4_C);
     writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL5, tempFIFO_CTRL5);
 
 }
@@ -854,6 +864,169 @@ uint16_t LSM6DS3::fifoGetStatus( void )
 }
 void LSM6DS3::fifoEnd( void )
 {
-    // turn off the fifo
-    writeRegister(LSM6DS3_ACC_GYRO_FIFO_STATUS1, 0x00);  //Disable
+    // turn off the fifo, bypass mode also flushes its content
+    writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL5, LSM6DS3_ACC_GYRO_FIFO_MODE_BYPASS);
+}
+
+//****************************************************************************//
+//
+//  fifoGetLevel
+//
+//  Parameters:
+//    *unreadWords -- number of 16 bit words waiting in the FIFO
+//    *pattern -- index in the data set pattern of the next word to be read
+//
+//  FIFO_STATUS1 to FIFO_STATUS4 are read in a single transaction.
+//
+//****************************************************************************//
+status_t LSM6DS3::fifoGetLevel( uint16_t* unreadWords, uint16_t* pattern )
+{
+    uint8_t myBuffer[4];
+    status_t returnError = readRegisterRegion(myBuffer, LSM6DS3_ACC_GYRO_FIFO_STATUS1, 4);
+
+    *unreadWords = (uint16_t)myBuffer[0] | ((uint16_t)(myBuffer[1] & 0x0F) << 8);
+    *pattern = (uint16_t)myBuffer[2] | ((uint16_t)(myBuffer[3] & 0x03) << 8);
+
+    //A full FIFO reports DIFF_FIFO = 0, return the whole depth instead
+    if( myBuffer[1] & LSM6DS3_ACC_GYRO_FIFO_FULL_FIFO_FULL ) {
+        *unreadWords = 4096;
+    }
+    if( myBuffer[1] & LSM6DS3_ACC_GYRO_FIFO_EMPTY_FIFO_EMPTY ) {
+        *unreadWords = 0;
+    }
+
+    return returnError;
+}
+
+//****************************************************************************//
+//
+//  fifoReadBurst
+//
+//  Parameters:
+//    *outputPointer -- Pass base address of a buffer of at least numWords
+//    numWords -- number of 16 bit FIFO words to read
+//
+//  With IF_INC set the address rolls back from FIFO_DATA_OUT_H to
+//  FIFO_DATA_OUT_L, so consecutive words are streamed in one transaction.
+//  Region reads are limited to 255 bytes, longer reads are split.
+//
+//****************************************************************************//
+status_t LSM6DS3::fifoReadBurst( int16_t* outputPointer, uint16_t numWords )
+{
+    status_t returnError = IMU_SUCCESS;
+
+    while( numWords > 0 ) {
+        uint8_t chunk = (numWords > 127) ? 127 : numWords;
+        uint8_t* bytes = (uint8_t*)outputPointer;
+
+        status_t errorLevel = readRegisterRegion(bytes, LSM6DS3_ACC_GYRO_FIFO_DATA_OUT_L, chunk * 2);
+        if( errorLevel != IMU_SUCCESS ) {
+            returnError = errorLevel;
+        }
+
+        //Bytes arrive LSByte first, fix up in place for big endian hosts
+        for( uint8_t i = 0; i < chunk; i++ ) {
+            outputPointer[i] = (int16_t)bytes[2 * i] | int16_t(bytes[2 * i + 1] << 8);
+        }
+
+        outputPointer += chunk;
+        numWords -= chunk;
+    }
+
+    return returnError;
+}
+
+//****************************************************************************//
+//
+//  fifoSetMode
+//
+//  Parameters:
+//    mode -- LSM6DS3_ACC_GYRO_FIFO_MODE_t value, the FIFO ODR is kept
+//
+//  Going through bypass mode empties the FIFO, this is how a stream-to-FIFO
+//  capture is re-armed after its window has been read out.
+//
+//****************************************************************************//
+status_t LSM6DS3::fifoSetMode( uint8_t mode )
+{
+    uint8_t tempFIFO_CTRL5;
+    status_t returnError = readRegister(&tempFIFO_CTRL5, LSM6DS3_ACC_GYRO_FIFO_CTRL5);
+    if( returnError != IMU_SUCCESS ) {
+        return returnError;
+    }
+
+    settings.fifoModeWord = mode & 0x07;
+    tempFIFO_CTRL5 = (tempFIFO_CTRL5 & ~0x07) | settings.fifoModeWord;
+    return writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL5, tempFIFO_CTRL5);
+}
+
+//****************************************************************************//
+//
+//  wakeUpBegin
+//
+//  Parameters:
+//    threshold -- WK_THS, 0 to 63 in units of accelRange / 64
+//    duration -- WAKE_DUR, 0 to 3 in units of one accelerometer ODR period
+//
+//  Routes the wake-up event to INT1 and latches it in WAKE_UP_SRC, it is
+//  also the trigger of the stream-to-FIFO and bypass-to-continuous modes.
+//
+//****************************************************************************//
+status_t LSM6DS3::wakeUpBegin( uint8_t threshold, uint8_t duration )
+{
+    uint8_t dataToWrite;
+
+    writeRegister(LSM6DS3_ACC_GYRO_WAKE_UP_THS, threshold & LSM6DS3_ACC_GYRO_WK_THS_MASK);
+    writeRegister(LSM6DS3_ACC_GYRO_WAKE_UP_DUR, (duration << LSM6DS3_ACC_GYRO_WAKE_DUR_POSITION) & LSM6DS3_ACC_GYRO_WAKE_DUR_MASK);
+
+    readRegister(&dataToWrite, LSM6DS3_ACC_GYRO_TAP_CFG1);
+    writeRegister(LSM6DS3_ACC_GYRO_TAP_CFG1, dataToWrite | LSM6DS3_ACC_GYRO_LIR_ENABLED);
+
+    readRegister(&dataToWrite, LSM6DS3_ACC_GYRO_MD1_CFG);
+    return writeRegister(LSM6DS3_ACC_GYRO_MD1_CFG, dataToWrite | LSM6DS3_ACC_GYRO_INT1_WU_ENABLED);
+}
+
+//****************************************************************************//
+//
+//  freeFallBegin
+//
+//  Parameters:
+//    threshold -- LSM6DS3_ACC_GYRO_FF_THS_t value
+//    duration -- FF_DUR, 0 to 63 in units of one accelerometer ODR period
+//
+//  Same routing as wakeUpBegin() for the free-fall event.
+//
+//****************************************************************************//
+status_t LSM6DS3::freeFallBegin( uint8_t threshold, uint8_t duration )
+{
+    uint8_t dataToWrite;
+
+    //FF_DUR[5] lives in WAKE_UP_DUR, FF_DUR[4:0] in FREE_FALL
+    readRegister(&dataToWrite, LSM6DS3_ACC_GYRO_WAKE_UP_DUR);
+    dataToWrite &= ~LSM6DS3_ACC_GYRO_FF_WAKE_UP_DUR_MASK;
+    dataToWrite |= ((duration >> 5) << LSM6DS3_ACC_GYRO_FF_WAKE_UP_DUR_POSITION) & LSM6DS3_ACC_GYRO_FF_WAKE_UP_DUR_MASK;
+    writeRegister(LSM6DS3_ACC_GYRO_WAKE_UP_DUR, dataToWrite);
+    writeRegister(LSM6DS3_ACC_GYRO_FREE_FALL, ((duration << LSM6DS3_ACC_GYRO_FF_FREE_FALL_DUR_POSITION) & LSM6DS3_ACC_GYRO_FF_FREE_FALL_DUR_MASK) | (threshold & 0x07));
+
+    readRegister(&dataToWrite, LSM6DS3_ACC_GYRO_TAP_CFG1);
+    writeRegister(LSM6DS3_ACC_GYRO_TAP_CFG1, dataToWrite | LSM6DS3_ACC_GYRO_LIR_ENABLED);
+
+    readRegister(&dataToWrite, LSM6DS3_ACC_GYRO_MD1_CFG);
+    return writeRegister(LSM6DS3_ACC_GYRO_MD1_CFG, dataToWrite | LSM6DS3_ACC_GYRO_INT1_FF_ENABLED);
+}
+
+//****************************************************************************//
+//
+//  readEventSource
+//
+//  Parameters:
+//    *outputPointer -- WAKE_UP_SRC content, see LSM6DS3_ACC_GYRO_WU_EV_STATUS_t
+//    and LSM6DS3_ACC_GYRO_FF_EV_STATUS_t
+//
+//  Reading the register clears the latched events.
+//
+//****************************************************************************//
+status_t LSM6DS3::readEventSource( uint8_t* outputPointer )
+{
+    return readRegister(outputPointer, LSM6DS3_ACC_GYRO_WAKE_UP_SRC);
 }
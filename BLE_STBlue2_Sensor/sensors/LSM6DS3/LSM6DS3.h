@@ -108,6 +108,7 @@ public:
     uint16_t fifoThreshold;
     int16_t fifoSampleRate;
     uint8_t fifoModeWord;
+    uint8_t fifoStopOnThreshold;
     
 };
 
@@ -169,6 +170,19 @@ public:
     int16_t fifoRead( void );
     uint16_t fifoGetStatus( void );
     void fifoEnd( void );
+
+    //Number of unread 16 bit words and index of the next word in the pattern
+    status_t fifoGetLevel( uint16_t*, uint16_t* );
+    //Multiple read of FIFO words through the FIFO_DATA_OUT rollover
+    status_t fifoReadBurst( int16_t*, uint16_t );
+    //Change the FIFO mode only, e.g. to re-arm a stream-to-FIFO capture
+    status_t fifoSetMode( uint8_t );
+
+    //Embedded event detection, latched and routed to INT1
+    status_t wakeUpBegin( uint8_t, uint8_t );
+    status_t freeFallBegin( uint8_t, uint8_t );
+    //Read and clear the latched wake-up/free-fall sources
+    status_t readEventSource( uint8_t* );
     
     float calcGyro( int32_t );
     float calcAccel( int32_t );
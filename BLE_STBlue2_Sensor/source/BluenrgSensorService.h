@@ -2,45 +2,49 @@
 #define MBED_BLE_BLUENRG2_SENSOR_SERVICE_H__
 
 #include "ble/BLE.h"
+#include "hal/us_ticker_api.h"
+#include "WindowStats.h"
+#include "VibrationAnalyzer.h"
+#include "QueueMonitor.h"
+#include "GattServiceTable.h"
+#include "BulkTransfer.h"
 
 #if BLE_FEATURE_GATT_SERVER
 
-static const char uuid_char1[] = "00040000-0001-11e1-ac36-0002a5d5c51b";
-static const char uuid_char2[] = "00e00000-0001-11e1-ac36-0002a5d5c51b";
-static const char uuid_ser[]   = "00000000-0001-11e1-9ab4-0002a5d5c51b";
-static const UUID _uuid1(uuid_char1);
-static const UUID _uuid2(uuid_char2);
-static const UUID _uuid_ser(uuid_ser);
+/* BlueST sensor service, "00000000-0001-11e1-9ab4-0002a5d5c51b" */
+static const UUID::LongUUIDBytes_t sensor_service_uuid =
+    GATT_UUID128(0x00000000, 0x0001, 0x11e1, 0x9ab4, 0x0002, 0xa5d5c51b);
 
 class BluenrgSensorService {
 
 public:
 
+    /* characteristics of the service, in the order of the definitions */
+    enum Characteristic {
+        CHAR_ENV,
+        CHAR_IMU,
+        CHAR_QUAT,
+        CHAR_STATS,
+        CHAR_SPECTRUM,
+        CHAR_CAPTURE,
+        CHAR_LOG,
+        CHAR_DIAG,
+        CHAR_COUNT
+    };
+
     BluenrgSensorService(BLE &_ble, int16_t temp, int16_t* accelValAxis, int16_t* gyroValAxis) :
         ble(_ble),
         sensValueBytes(temp, accelValAxis, gyroValAxis),
-        _char_env(
-            _uuid1,
-            sensValueBytes.getEnvPointer(),
-            sensValueBytes.getEnvNumValueBytes(),
-			SensorValueBytes::MAX_VALUE_BYTES_ENV,
-            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ
-        ),
-        _char_imu(
-            _uuid2,
-            sensValueBytes.getImuPointer(),
-            sensValueBytes.getImuNumValueBytes(),
-            SensorValueBytes::MAX_VALUE_BYTES_IMU,
-            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY
-        )
+        _setup_us(0)
     {
         setupService();
     }
 
-    void updateTemperature(uint16_t temp) {
+    void updateTemperature(uint16_t timestamp, uint16_t temp) {
+        sensValueBytes.updateEnvTimestamp(timestamp);
         sensValueBytes.updateTemp(temp);
         ble.gattServer().write(
-            _char_env.getValueHandle(),
+            _table.value_handle(CHAR_ENV),
             sensValueBytes.getEnvPointer(),
             sensValueBytes.getEnvNumValueBytes()
         );
@@ -49,7 +53,7 @@ public:
     void updateAccel(int16_t* accelValAxis) {
         sensValueBytes.updateAccel(accelValAxis);
         ble.gattServer().write(
-            _char_imu.getValueHandle(),
+            _table.value_handle(CHAR_IMU),
             sensValueBytes.getImuPointer(),
             sensValueBytes.getImuNumValueBytes()
         );
@@ -58,38 +62,218 @@ public:
     void updateGyro(int16_t* gyroValAxis) {
         sensValueBytes.updateGyro(gyroValAxis);
         ble.gattServer().write(
-            _char_imu.getValueHandle(),
+            _table.value_handle(CHAR_IMU),
+            sensValueBytes.getImuPointer(),
+            sensValueBytes.getImuNumValueBytes()
+        );
+    }
+
+    /** Accel and gyro in a single notification. */
+    void updateImu(uint16_t timestamp, int16_t* accelValAxis, int16_t* gyroValAxis) {
+        sensValueBytes.updateImuTimestamp(timestamp);
+        sensValueBytes.updateAccel(accelValAxis);
+        sensValueBytes.updateGyro(gyroValAxis);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_IMU),
             sensValueBytes.getImuPointer(),
             sensValueBytes.getImuNumValueBytes()
         );
     }
 
+    void updateQuaternion(uint16_t timestamp, int16_t* quatVector) {
+        sensValueBytes.updateQuat(timestamp, quatVector);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_QUAT),
+            sensValueBytes.getQuatPointer(),
+            sensValueBytes.getQuatNumValueBytes()
+        );
+    }
+
+    void updateStats(uint16_t timestamp, uint8_t stream, uint8_t window, const WindowStats &stats) {
+        sensValueBytes.updateStats(timestamp, stream, window, stats);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_STATS),
+            sensValueBytes.getStatsPointer(),
+            sensValueBytes.getStatsNumValueBytes()
+        );
+    }
+
+    void updateSpectrum(uint16_t timestamp, uint16_t sampleRate, uint8_t axis, const VibrationSpectrum &spectrum) {
+        sensValueBytes.updateSpectrum(timestamp, sampleRate, axis, spectrum);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_SPECTRUM),
+            sensValueBytes.getSpectrumPointer(),
+            sensValueBytes.getSpectrumNumValueBytes()
+        );
+    }
+
+    /**
+     * Send one BulkTransfer segment of a shock capture window, raw
+     * accelerometer {X, Y, Z} samples.
+     *
+     * @return Error of the write, the segment has to be sent again on failure.
+     */
+    ble_error_t updateCapture(const uint8_t *segment, unsigned length) {
+        return notifySegment(CHAR_CAPTURE, segment, length);
+    }
+
+    /**
+     * Send one BulkTransfer segment of the offline log download.
+     *
+     * @return Error of the write, the segment has to be sent again on failure.
+     */
+    ble_error_t updateLog(const uint8_t *segment, unsigned length) {
+        return notifySegment(CHAR_LOG, segment, length);
+    }
+
+    /** One task of a closed event queue window. */
+    void updateTaskDiagnostics(uint16_t timestamp, uint8_t window, uint8_t task, const QueueMonitor::TaskStats &stats) {
+        sensValueBytes.updateTaskDiag(timestamp, window, task, stats);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_DIAG),
+            sensValueBytes.getDiagPointer(),
+            sensValueBytes.getDiagNumValueBytes()
+        );
+    }
+
+    /** Event queue figures since boot. */
+    void updateQueueDiagnostics(uint16_t timestamp, uint8_t window, const QueueMonitor &monitor) {
+        sensValueBytes.updateQueueDiag(timestamp, window, monitor);
+        ble.gattServer().write(
+            _table.value_handle(CHAR_DIAG),
+            sensValueBytes.getDiagPointer(),
+            sensValueBytes.getDiagNumValueBytes()
+        );
+    }
+
+    /** Handle of the log characteristic, the central writes its commands there. */
+    GattAttribute::Handle_t getLogHandle() {
+        return _table.value_handle(CHAR_LOG);
+    }
+
+    /** Time spent registering the service, in microseconds. */
+    uint32_t setupTime() const {
+        return _setup_us;
+    }
+
 protected:
 
+    /*
+     * Refused while the central has not enabled notifications: the value
+     * would be written but never sent, and never reported by onDataSent.
+     */
+    ble_error_t notifySegment(Characteristic characteristic, const uint8_t *segment, unsigned length) {
+        bool enabled = false;
+        ble.gattServer().areUpdatesEnabled(_table.characteristic(characteristic), &enabled);
+        if (!enabled) {
+            return BLE_ERROR_INVALID_STATE;
+        }
+        return ble.gattServer().write(_table.value_handle(characteristic), segment, length);
+    }
+
     void setupService(void) {
-        GattCharacteristic *charTable[] = {
-            &_char_env,
-            &_char_imu
+        uint8_t *const values[CHAR_COUNT] = {
+            sensValueBytes.getEnvPointer(),
+            sensValueBytes.getImuPointer(),
+            sensValueBytes.getQuatPointer(),
+            sensValueBytes.getStatsPointer(),
+            sensValueBytes.getSpectrumPointer(),
+            sensValueBytes.getCapturePointer(),
+            sensValueBytes.getLogPointer(),
+            sensValueBytes.getDiagPointer()
         };
-        GattService SensorService(
-            _uuid_ser,
-            charTable,
-            sizeof(charTable) / sizeof(GattCharacteristic*)
-        );
 
+        uint32_t start = us_ticker_read();
+        ble.gattServer().addService(_table.build(sensor_service_uuid, definitions(), values));
+        _setup_us = us_ticker_read() - start;
+    }
 
-        ble.gattServer().addService(SensorService);
+    /* Constant initialized: the table is in flash and costs no startup code. */
+    static const GattCharacteristicDef (&definitions())[CHAR_COUNT] {
+        static const GattCharacteristicDef table[CHAR_COUNT] = {
+            /* env */ {
+                GATT_UUID128(0x00040000, 0x0001, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_ENV,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+                false
+            },
+            /* imu */ {
+                GATT_UUID128(0x00e00000, 0x0001, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_IMU,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                false
+            },
+            /* quaternion */ {
+                GATT_UUID128(0x00000100, 0x0001, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_QUAT,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                false
+            },
+            /* stats */ {
+                GATT_UUID128(0x00000000, 0x0010, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_STATS,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+                false
+            },
+            /* spectrum */ {
+                GATT_UUID128(0x00000000, 0x0011, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_SPECTRUM,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+                false
+            },
+            /* capture */ {
+                GATT_UUID128(0x00000000, 0x0012, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_CAPTURE,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                true
+            },
+            /* log */ {
+                GATT_UUID128(0x00000000, 0x0013, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_LOG,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE,
+                true
+            },
+            /* diagnostics */ {
+                GATT_UUID128(0x00000000, 0x0014, 0x11e1, 0xac36, 0x0002, 0xa5d5c51b),
+                SensorValueBytes::MAX_VALUE_BYTES_DIAG,
+                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+                false
+            }
+        };
+        return table;
     }
 
 protected:
 
     struct SensorValueBytes {
-        /* 1 byte for the Flags, and up to two bytes for heart rate value. */
+        /* 2 bytes timestamp, then accelerometer and gyroscope axes. */
         static const unsigned MAX_VALUE_BYTES_IMU = 14;
+        /* 2 bytes timestamp, then the temperature. */
         static const unsigned MAX_VALUE_BYTES_ENV = 4;
+        /* 2 bytes timestamp, then qi, qj, qk scaled by 10000 (compact sensor fusion). */
+        static const unsigned MAX_VALUE_BYTES_QUAT = 8;
+        /* 2 bytes timestamp, stream id, window counter, count, min, max, mean, rms, variance. */
+        static const unsigned MAX_VALUE_BYTES_STATS = 18;
+        /* 2 bytes timestamp, sample rate, log2 FFT size, axis, peak Hz, peak amplitude, band RMS. */
+        static const unsigned MAX_VALUE_BYTES_SPECTRUM = 10 + 2 * VibrationSpectrum::BANDS;
+        /*
+         * BulkTransfer segments: 2 bytes index (bit 15 set on the last one), then data,
+         * up to the notification payload of the largest ATT MTU.
+         */
+        static const unsigned MAX_VALUE_BYTES_CAPTURE = BulkTransfer::MAX_SEGMENT_SIZE;
+        static const unsigned MAX_VALUE_BYTES_LOG = BulkTransfer::MAX_SEGMENT_SIZE;
+        /*
+         * 2 bytes timestamp, window counter, record id, then for a task: runs and average exec us
+         * (16 bits), max exec, jitter and latency us (32 bits); for the queue record
+         * (DIAG_QUEUE_RECORD): depth, high-water, posts and alloc failures (32 bits).
+         */
+        static const unsigned MAX_VALUE_BYTES_DIAG = 20;
+        static const uint8_t DIAG_QUEUE_RECORD = 0xFF;
         static const unsigned FLAGS_BYTE_INDEX = 0;
 
-        SensorValueBytes(int16_t temp, int16_t* accelValAxis, int16_t* gyroValAxis) : envValueBytes()
+        SensorValueBytes(int16_t temp, int16_t* accelValAxis, int16_t* gyroValAxis) : envValueBytes(), quatValueBytes(), statsValueBytes(), spectrumValueBytes(), captureValueBytes(), logValueBytes(), diagValueBytes()
         {
             updateTemp(temp);
             updateAccel(accelValAxis);
@@ -97,6 +281,12 @@ protected:
 //            updatePress(press);
         }
 
+        void updateEnvTimestamp(uint16_t timestamp)
+        {
+        	envValueBytes[0] = (uint8_t)timestamp;
+        	envValueBytes[1] = (uint8_t)(timestamp >> 8);
+        }
+
         void updateTemp(int16_t temp)
         {
 
@@ -113,6 +303,12 @@ protected:
 //        	envValueBytes[5] |= (uint8_t)(press >> 24);
 //        }
 
+        void updateImuTimestamp(uint16_t timestamp)
+        {
+        	imuValueBytes[0] = (uint8_t)timestamp;
+        	imuValueBytes[1] = (uint8_t)(timestamp >> 8);
+        }
+
         void updateAccel(int16_t* accelValAxis) //valAxis[] = {-valY, valX, -valZ}
         {
         	imuValueBytes[2] = (uint8_t)(-accelValAxis[0]>>2);
@@ -133,6 +329,76 @@ protected:
         	imuValueBytes[13] = (uint8_t)((gyroValAxis[2]<<4) >> 8);
         }
 
+        void updateQuat(uint16_t timestamp, int16_t* quatVector) //quatVector[] = {qi, qj, qk}
+        {
+        	quatValueBytes[0] = (uint8_t)timestamp;
+        	quatValueBytes[1] = (uint8_t)(timestamp >> 8);
+        	for (unsigned i = 0; i < 3; i++) {
+        		quatValueBytes[2 + 2 * i] = (uint8_t)quatVector[i];
+        		quatValueBytes[3 + 2 * i] = (uint8_t)(quatVector[i] >> 8);
+        	}
+        }
+
+        void updateStats(uint16_t timestamp, uint8_t stream, uint8_t window, const WindowStats &stats)
+        {
+        	uint32_t variance = stats.variance();
+        	/* count and rms are unsigned, min, max and mean signed */
+        	uint16_t fields[5] = {
+        		stats.count(), (uint16_t)stats.min(), (uint16_t)stats.max(), (uint16_t)stats.mean(), stats.rms()
+        	};
+
+        	statsValueBytes[0] = (uint8_t)timestamp;
+        	statsValueBytes[1] = (uint8_t)(timestamp >> 8);
+        	statsValueBytes[2] = stream;
+        	statsValueBytes[3] = window;
+        	for (unsigned i = 0; i < 5; i++) {
+        		statsValueBytes[4 + 2 * i] = (uint8_t)fields[i];
+        		statsValueBytes[5 + 2 * i] = (uint8_t)(fields[i] >> 8);
+        	}
+        	for (unsigned i = 0; i < 4; i++) {
+        		statsValueBytes[14 + i] = (uint8_t)(variance >> (8 * i));
+        	}
+        }
+
+        void updateSpectrum(uint16_t timestamp, uint16_t sampleRate, uint8_t axis, const VibrationSpectrum &spectrum)
+        {
+        	spectrumValueBytes[0] = (uint8_t)timestamp;
+        	spectrumValueBytes[1] = (uint8_t)(timestamp >> 8);
+        	spectrumValueBytes[2] = (uint8_t)sampleRate;
+        	spectrumValueBytes[3] = (uint8_t)(sampleRate >> 8);
+        	spectrumValueBytes[4] = VibrationAnalyzer::FFT_SIZE_LOG2;
+        	spectrumValueBytes[5] = axis;
+        	spectrumValueBytes[6] = (uint8_t)spectrum.peak_hz;
+        	spectrumValueBytes[7] = (uint8_t)(spectrum.peak_hz >> 8);
+        	spectrumValueBytes[8] = (uint8_t)spectrum.peak_amplitude;
+        	spectrumValueBytes[9] = (uint8_t)(spectrum.peak_amplitude >> 8);
+        	for (unsigned i = 0; i < VibrationSpectrum::BANDS; i++) {
+        		spectrumValueBytes[10 + 2 * i] = (uint8_t)spectrum.band_rms[i];
+        		spectrumValueBytes[11 + 2 * i] = (uint8_t)(spectrum.band_rms[i] >> 8);
+        	}
+        }
+
+        void updateTaskDiag(uint16_t timestamp, uint8_t window, uint8_t task, const QueueMonitor::TaskStats &stats)
+        {
+        	uint32_t exec_avg_us = stats.runs ? stats.exec_total_us / stats.runs : 0;
+
+        	updateDiagHeader(timestamp, window, task);
+        	putDiag16(4, stats.runs);
+        	putDiag16(6, exec_avg_us);
+        	putDiag32(8, stats.exec_max_us);
+        	putDiag32(12, stats.jitter_max_us);
+        	putDiag32(16, stats.latency_max_us);
+        }
+
+        void updateQueueDiag(uint16_t timestamp, uint8_t window, const QueueMonitor &monitor)
+        {
+        	updateDiagHeader(timestamp, window, DIAG_QUEUE_RECORD);
+        	putDiag32(4, monitor.depth());
+        	putDiag32(8, monitor.highWater());
+        	putDiag32(12, monitor.posts());
+        	putDiag32(16, monitor.allocFailures());
+        }
+
         uint8_t *getEnvPointer(void)
         {
             return envValueBytes;
@@ -163,16 +429,127 @@ protected:
         	return this->MAX_VALUE_BYTES_IMU;
         }
 
+        uint8_t *getQuatPointer(void)
+        {
+            return quatValueBytes;
+        }
+
+        const uint8_t *getQuatPointer(void) const
+        {
+            return quatValueBytes;
+        }
+
+        unsigned getQuatNumValueBytes(void) const
+        {
+        	return this->MAX_VALUE_BYTES_QUAT;
+        }
+
+        uint8_t *getStatsPointer(void)
+        {
+            return statsValueBytes;
+        }
+
+        const uint8_t *getStatsPointer(void) const
+        {
+            return statsValueBytes;
+        }
+
+        unsigned getStatsNumValueBytes(void) const
+        {
+        	return this->MAX_VALUE_BYTES_STATS;
+        }
+
+        uint8_t *getSpectrumPointer(void)
+        {
+            return spectrumValueBytes;
+        }
+
+        const uint8_t *getSpectrumPointer(void) const
+        {
+            return spectrumValueBytes;
+        }
+
+        unsigned getSpectrumNumValueBytes(void) const
+        {
+        	return this->MAX_VALUE_BYTES_SPECTRUM;
+        }
+
+        uint8_t *getCapturePointer(void)
+        {
+            return captureValueBytes;
+        }
+
+        const uint8_t *getCapturePointer(void) const
+        {
+            return captureValueBytes;
+        }
+
+        uint8_t *getLogPointer(void)
+        {
+            return logValueBytes;
+        }
+
+        const uint8_t *getLogPointer(void) const
+        {
+            return logValueBytes;
+        }
+
+        uint8_t *getDiagPointer(void)
+        {
+            return diagValueBytes;
+        }
+
+        const uint8_t *getDiagPointer(void) const
+        {
+            return diagValueBytes;
+        }
+
+        unsigned getDiagNumValueBytes(void) const
+        {
+        	return this->MAX_VALUE_BYTES_DIAG;
+        }
+
     private:
         uint8_t envValueBytes[MAX_VALUE_BYTES_ENV];
         uint8_t imuValueBytes[MAX_VALUE_BYTES_IMU];
+        uint8_t quatValueBytes[MAX_VALUE_BYTES_QUAT];
+        uint8_t statsValueBytes[MAX_VALUE_BYTES_STATS];
+        uint8_t spectrumValueBytes[MAX_VALUE_BYTES_SPECTRUM];
+        uint8_t captureValueBytes[MAX_VALUE_BYTES_CAPTURE];
+        uint8_t logValueBytes[MAX_VALUE_BYTES_LOG];
+        uint8_t diagValueBytes[MAX_VALUE_BYTES_DIAG];
+
+        void updateDiagHeader(uint16_t timestamp, uint8_t window, uint8_t record)
+        {
+        	diagValueBytes[0] = (uint8_t)timestamp;
+        	diagValueBytes[1] = (uint8_t)(timestamp >> 8);
+        	diagValueBytes[2] = window;
+        	diagValueBytes[3] = record;
+        }
+
+        /* saturated rather than wrapped */
+        void putDiag16(unsigned offset, uint32_t v)
+        {
+        	if (v > UINT16_MAX) {
+        		v = UINT16_MAX;
+        	}
+        	diagValueBytes[offset] = (uint8_t)v;
+        	diagValueBytes[offset + 1] = (uint8_t)(v >> 8);
+        }
+
+        void putDiag32(unsigned offset, uint32_t v)
+        {
+        	for (unsigned i = 0; i < 4; i++) {
+        		diagValueBytes[offset + i] = (uint8_t)(v >> (8 * i));
+        	}
+        }
     };
 
 protected:
     BLE &ble;
     SensorValueBytes sensValueBytes;
-    GattCharacteristic _char_env;
-    GattCharacteristic _char_imu;
+    GattServiceTable<CHAR_COUNT> _table;
+    uint32_t _setup_us;
 };
 
 #endif // BLE_FEATURE_GATT_SERVER
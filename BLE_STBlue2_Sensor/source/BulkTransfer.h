@@ -0,0 +1,202 @@
+/*
+ * BulkTransfer.h
+ *
+ * Credit based segmentation of a byte stream over notifications.
+ */
+
+#ifndef SOURCE_BULKTRANSFER_H_
+#define SOURCE_BULKTRANSFER_H_
+
+#include <mbed.h>
+#include "ble/BLE.h"
+
+/**
+ * Sends a stream as numbered segments: a 2 byte little endian index, bit 15
+ * set on the last segment, then up to segment_size - 2 bytes of data.
+ *
+ * Flow control follows the L2CAP credit based scheme: a credit is one
+ * segment the stack may hold, it is spent on every accepted write and
+ * given back through GattServer::onDataSent. A segment the stack refused
+ * is kept and sent again, so the data source is read exactly once. The
+ * sink must refuse a segment nobody is subscribed to: the stack accepts
+ * the write but never reports it sent, the credit would be lost.
+ *
+ * A transfer started without credits is the plain notification path for
+ * comparison: segments of the default ATT MTU written until the stack
+ * refuses one.
+ */
+class BulkTransfer {
+public:
+    /** Fill up to max bytes, set last at the end of the stream; returns the byte count. */
+    typedef mbed::Callback<unsigned(uint8_t*, unsigned, bool*)> Source;
+    /** Send one segment. */
+    typedef mbed::Callback<ble_error_t(const uint8_t*, unsigned)> Sink;
+
+    static const unsigned HEADER_SIZE = 2;
+    /* ATT payload of the default MTU of 23 */
+    static const unsigned DEFAULT_SEGMENT_SIZE = 20;
+    /* largest ATT payload once the MTU has been raised (247 - 3) */
+    static const unsigned MAX_SEGMENT_SIZE = 244;
+
+    BulkTransfer(uint8_t credits, unsigned segment_size) :
+        _max_credits(credits ? credits : 1),
+        _credits(_max_credits),
+        _in_flight(0),
+        _segment_size(0),
+        _transfer_segment_size(0),
+        _credit_based(true),
+        _active(false),
+        _pending(0)
+    {
+        setSegmentSize(segment_size);
+    }
+
+    /**
+     * Segment size, including the header, from the ATT MTU or the channel
+     * MPS. A running credit based transfer uses it from its next segment.
+     */
+    void setSegmentSize(unsigned segment_size)
+    {
+        if (segment_size > MAX_SEGMENT_SIZE) {
+            segment_size = MAX_SEGMENT_SIZE;
+        }
+        if (segment_size < HEADER_SIZE + 1) {
+            segment_size = HEADER_SIZE + 1;
+        }
+        _segment_size = segment_size;
+        if (_credit_based) {
+            _transfer_segment_size = segment_size;
+        }
+    }
+
+    unsigned segmentSize() const
+    {
+        return _segment_size;
+    }
+
+    /**
+     * The clock starts with the first segment, not while waiting for a
+     * connection. Without credit_based the segments have the default size
+     * and are written until the stack refuses one.
+     */
+    void start(Source source, Sink sink, bool credit_based = true)
+    {
+        _source = source;
+        _sink = sink;
+        resetCredits();
+        _credit_based = credit_based;
+        _transfer_segment_size = credit_based ? _segment_size : DEFAULT_SEGMENT_SIZE;
+        _active = true;
+        _pending = 0;
+        _index = 0;
+        _bytes = 0;
+        _elapsed_ms = 0;
+    }
+
+    void cancel()
+    {
+        _active = false;
+    }
+
+    bool active() const
+    {
+        return _active;
+    }
+
+    /** All credits back, e.g. on a new connection. */
+    void resetCredits()
+    {
+        _credits = _max_credits;
+        _in_flight = 0;
+    }
+
+    /**
+     * Notifications the stack reports sent, for every characteristic. Only
+     * the segments of this transfer still in flight are credited back.
+     *
+     * @return Notifications taken, the rest belong to other characteristics.
+     */
+    unsigned onDataSent(unsigned count)
+    {
+        if (count > _in_flight) {
+            count = _in_flight;
+        }
+        _in_flight -= count;
+        unsigned credits = _credits + count;
+        _credits = (credits > _max_credits) ? _max_credits : credits;
+        return count;
+    }
+
+    /** Send segments while there are credits and data. */
+    void pump(uint32_t now_ms)
+    {
+        while (_active && (_credits || !_credit_based)) {
+            if (!_pending) {
+                if (!_index) {
+                    _start_ms = now_ms;
+                }
+                bool last = false;
+                unsigned length = _source(&_segment[HEADER_SIZE], _transfer_segment_size - HEADER_SIZE, &last);
+                uint16_t index = _index | (last ? 0x8000 : 0);
+                _segment[0] = (uint8_t)index;
+                _segment[1] = (uint8_t)(index >> 8);
+                _pending = HEADER_SIZE + length;
+                _last = last;
+            }
+
+            if (_sink(_segment, _pending) != BLE_ERROR_NONE) {
+                return;
+            }
+
+            if (_credits) {
+                _credits--;
+            }
+            _in_flight++;
+            _bytes += _pending;
+            _index++;
+            _pending = 0;
+            if (_last) {
+                _active = false;
+                _elapsed_ms = now_ms - _start_ms;
+            }
+        }
+    }
+
+    /** Segment size of the last transfer, header included. */
+    unsigned transferSegmentSize() const
+    {
+        return _transfer_segment_size;
+    }
+
+    /** Bytes sent by the last transfer, headers included. */
+    uint32_t bytes() const
+    {
+        return _bytes;
+    }
+
+    /** Duration of the last completed transfer. */
+    uint32_t elapsedMs() const
+    {
+        return _elapsed_ms;
+    }
+
+private:
+    Source _source;
+    Sink _sink;
+    uint8_t _max_credits;
+    uint8_t _credits;
+    uint16_t _in_flight;
+    unsigned _segment_size;
+    unsigned _transfer_segment_size;
+    bool _credit_based;
+    bool _active;
+    bool _last;
+    unsigned _pending;
+    uint16_t _index;
+    uint32_t _bytes;
+    uint32_t _start_ms;
+    uint32_t _elapsed_ms;
+    uint8_t _segment[MAX_SEGMENT_SIZE];
+};
+
+#endif /* SOURCE_BULKTRANSFER_H_ */
@@ -0,0 +1,38 @@
+/*
+ * CycleCounter.h
+ *
+ * Core clock cycle counter used by the on-device benchmarks.
+ */
+
+#ifndef SOURCE_CYCLECOUNTER_H_
+#define SOURCE_CYCLECOUNTER_H_
+
+#include <mbed.h>
+
+/**
+ * Thin wrapper over the DWT cycle counter of Cortex-M3/M4/M7 cores.
+ *
+ * On cores without a DWT (Cortex-M0/M0+) every read returns 0 so the
+ * benchmarks report nothing instead of failing to build.
+ */
+struct CycleCounter {
+    static void enable()
+    {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    }
+
+    static uint32_t read()
+    {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+        return DWT->CYCCNT;
+#else
+        return 0;
+#endif
+    }
+};
+
+#endif /* SOURCE_CYCLECOUNTER_H_ */
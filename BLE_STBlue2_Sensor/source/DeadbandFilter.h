@@ -0,0 +1,110 @@
+/*
+ * DeadbandFilter.h
+ *
+ * Report-by-exception decision for one notified stream.
+ */
+
+#ifndef SOURCE_DEADBANDFILTER_H_
+#define SOURCE_DEADBANDFILTER_H_
+
+#include <stdint.h>
+
+/**
+ * Lets a set of up to MAX_VALUES values through only when one of them moved
+ * beyond its deadband, or when nothing was sent for heartbeat_ms.
+ *
+ * Values are compared with the last reported ones rather than the previous
+ * samples, so noise around a level never accumulates into a report while
+ * a slow drift still does once it crosses the deadband.
+ */
+class DeadbandFilter {
+public:
+    static const unsigned MAX_VALUES = 8;
+
+    /**
+     * @param[in] deadband Deadband applied to every value, in raw units.
+     * @param[in] heartbeat_ms Longest silence, 0 to never force a report.
+     */
+    DeadbandFilter(uint16_t deadband, uint32_t heartbeat_ms) :
+        _heartbeat_ms(heartbeat_ms),
+        _last_ms(0),
+        _pending(true),
+        _sent(0),
+        _suppressed(0)
+    {
+        for (unsigned i = 0; i < MAX_VALUES; i++) {
+            _deadband[i] = deadband;
+            _last[i] = 0;
+        }
+    }
+
+    void setDeadband(unsigned index, uint16_t deadband)
+    {
+        if (index < MAX_VALUES) {
+            _deadband[index] = deadband;
+        }
+    }
+
+    /** Report the next update whatever its value, e.g. for a new subscriber. */
+    void force()
+    {
+        _pending = true;
+    }
+
+    /**
+     * Decide whether the values have to be reported and remember them if so.
+     *
+     * @param[in] values Current values.
+     * @param[in] count Number of values, up to MAX_VALUES.
+     * @param[in] now_ms Current time in milliseconds.
+     * @return true when the values must be sent.
+     */
+    bool update(const int16_t *values, unsigned count, uint32_t now_ms)
+    {
+        if (count > MAX_VALUES) {
+            count = MAX_VALUES;
+        }
+
+        bool send = _pending || (_heartbeat_ms && (now_ms - _last_ms) >= _heartbeat_ms);
+        for (unsigned i = 0; i < count && !send; i++) {
+            int32_t delta = (int32_t)values[i] - _last[i];
+            if (delta > _deadband[i] || -delta > _deadband[i]) {
+                send = true;
+            }
+        }
+
+        if (!send) {
+            _suppressed++;
+            return false;
+        }
+
+        for (unsigned i = 0; i < count; i++) {
+            _last[i] = values[i];
+        }
+        _last_ms = now_ms;
+        _pending = false;
+        _sent++;
+        return true;
+    }
+
+    uint32_t sent() const
+    {
+        return _sent;
+    }
+
+    uint32_t suppressed() const
+    {
+        return _suppressed;
+    }
+
+private:
+    uint16_t _deadband[MAX_VALUES];
+    int16_t _last[MAX_VALUES];
+    uint32_t _heartbeat_ms;
+    uint32_t _last_ms;
+    bool _pending;
+    uint32_t _sent;
+    uint32_t _suppressed;
+};
+
+#endif /* SOURCE_DEADBANDFILTER_H_ */
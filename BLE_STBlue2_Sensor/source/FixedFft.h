@@ -0,0 +1,153 @@
+/*
+ * FixedFft.h
+ *
+ * Q15 real FFT with the same scaling as CMSIS-DSP arm_rfft_q15: every
+ * butterfly stage halves its output, so bin k holds X[k] / N and the
+ * transform can never overflow.
+ *
+ * This header only depends on <stdint.h> so it builds on the host as well.
+ * Define FIXED_FFT_USE_CMSIS_DSP to route rfft_q15() through arm_rfft_q15
+ * when the CMSIS-DSP library is linked in.
+ */
+
+#ifndef SOURCE_FIXEDFFT_H_
+#define SOURCE_FIXEDFFT_H_
+
+#include <stdint.h>
+
+#if defined(FIXED_FFT_USE_CMSIS_DSP)
+#include "arm_math.h"
+#endif
+
+namespace fixed_fft {
+
+/** Largest supported transform, bounded by the resolution of the sine table. */
+static const unsigned MAX_SIZE = 256;
+
+/* sin(2 * pi * k / 256) in Q15, k = 0..64 */
+static const int16_t QUARTER_SINE_Q15[65] = {
+        0,   804,  1608,  2411,  3212,  4011,  4808,  5602,
+     6393,  7180,  7962,  8740,  9512, 10279, 11039, 11793,
+    12540, 13279, 14010, 14733, 15447, 16151, 16846, 17531,
+    18205, 18868, 19520, 20160, 20788, 21403, 22006, 22595,
+    23170, 23732, 24279, 24812, 25330, 25833, 26320, 26791,
+    27246, 27684, 28106, 28511, 28899, 29269, 29622, 29957,
+    30274, 30572, 30853, 31114, 31357, 31581, 31786, 31972,
+    32138, 32286, 32413, 32522, 32610, 32679, 32729, 32758,
+    32767
+};
+
+/** sin(2 * pi * k / 256) in Q15. */
+inline int16_t sin_q15(unsigned k)
+{
+    k &= 255;
+    if (k < 64) {
+        return QUARTER_SINE_Q15[k];
+    } else if (k < 128) {
+        return QUARTER_SINE_Q15[128 - k];
+    } else if (k < 192) {
+        return -QUARTER_SINE_Q15[k - 128];
+    }
+    return -QUARTER_SINE_Q15[256 - k];
+}
+
+/** cos(2 * pi * k / 256) in Q15. */
+inline int16_t cos_q15(unsigned k)
+{
+    return sin_q15(k + 64);
+}
+
+/**
+ * In-place radix-2 complex FFT on interleaved {re, im} Q15 data.
+ *
+ * @param[in,out] data 2 * n values.
+ * @param[in] n Number of complex points, power of two up to MAX_SIZE.
+ */
+inline void cfft_q15(int16_t *data, unsigned n)
+{
+    /* bit reversal permutation */
+    for (unsigned i = 1, j = 0; i < n; i++) {
+        unsigned bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int16_t tr = data[2 * i], ti = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = tr;
+            data[2 * j + 1] = ti;
+        }
+    }
+
+    for (unsigned len = 2; len <= n; len <<= 1) {
+        unsigned half = len >> 1;
+        unsigned step = MAX_SIZE / len;
+
+        for (unsigned start = 0; start < n; start += len) {
+            for (unsigned k = 0; k < half; k++) {
+                int32_t c = cos_q15(k * step);
+                int32_t s = sin_q15(k * step);
+                int16_t *a = &data[2 * (start + k)];
+                int16_t *b = &data[2 * (start + k + half)];
+
+                /* b * e^(-j theta) */
+                int32_t tr = (b[0] * c + b[1] * s) >> 15;
+                int32_t ti = (b[1] * c - b[0] * s) >> 15;
+                int32_t ur = a[0];
+                int32_t ui = a[1];
+
+                a[0] = (int16_t)((ur + tr) >> 1);
+                a[1] = (int16_t)((ui + ti) >> 1);
+                b[0] = (int16_t)((ur - tr) >> 1);
+                b[1] = (int16_t)((ui - ti) >> 1);
+            }
+        }
+    }
+}
+
+/**
+ * Real FFT of n Q15 samples.
+ *
+ * @param[in,out] in n real samples, destroyed by the transform.
+ * @param[out] out Interleaved {re, im} for bins 0 to n / 2, n + 2 values
+ * (2 * n with CMSIS-DSP, which also writes the mirrored upper half).
+ * @param[in] n Number of real samples, power of two from 4 to MAX_SIZE.
+ */
+inline void rfft_q15(int16_t *in, int16_t *out, unsigned n)
+{
+#if defined(FIXED_FFT_USE_CMSIS_DSP)
+    arm_rfft_instance_q15 instance;
+    arm_rfft_init_q15(&instance, n, 0, 1);
+    arm_rfft_q15(&instance, in, out);
+#else
+    /* even/odd samples form an n / 2 point complex sequence */
+    unsigned m = n >> 1;
+    cfft_q15(in, m);
+
+    unsigned step = MAX_SIZE / n;
+    for (unsigned k = 0; k <= m; k++) {
+        unsigned ka = (k == m) ? 0 : k;
+        unsigned kb = (k == 0) ? 0 : m - k;
+
+        int32_t ar = in[2 * ka], ai = in[2 * ka + 1];
+        int32_t br = in[2 * kb], bi = -in[2 * kb + 1];
+
+        int32_t er = (ar + br) >> 1;
+        int32_t ei = (ai + bi) >> 1;
+        int32_t or_ = (ai - bi) >> 1;
+        int32_t oi = (br - ar) >> 1;
+
+        int32_t c = cos_q15(k * step);
+        int32_t s = sin_q15(k * step);
+
+        out[2 * k] = (int16_t)((er + ((or_ * c + oi * s) >> 15)) >> 1);
+        out[2 * k + 1] = (int16_t)((ei + ((oi * c - or_ * s) >> 15)) >> 1);
+    }
+#endif
+}
+
+} // namespace fixed_fft
+
+#endif /* SOURCE_FIXEDFFT_H_ */
@@ -0,0 +1,54 @@
+/*
+ * FixedPoint.h
+ *
+ * Integer helpers shared by the on-device processing stages.
+ */
+
+#ifndef SOURCE_FIXEDPOINT_H_
+#define SOURCE_FIXEDPOINT_H_
+
+#include <stdint.h>
+
+/** Floor of the square root of x, bit by bit. */
+inline uint32_t isqrt32(uint32_t x)
+{
+    uint32_t res = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+/** Floor of the square root of a 64 bit value. */
+inline uint32_t isqrt64(uint64_t x)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+#endif /* SOURCE_FIXEDPOINT_H_ */
@@ -0,0 +1,316 @@
+/*
+ * FlashLog.h
+ *
+ * Append-only ring of log records in the internal flash.
+ */
+
+#ifndef SOURCE_FLASHLOG_H_
+#define SOURCE_FLASHLOG_H_
+
+#include <mbed.h>
+#include "LogFormat.h"
+
+/**
+ * The log occupies the last bytes of the internal flash, below an optional
+ * reserved area such as the BLE stack database, split in erase sectors.
+ * It never reaches down into the application image. Records never straddle a sector; when the head sector is full
+ * the next one is erased, dropping the oldest records.
+ *
+ * Crash safety comes from the record CRC: mount() resumes after the last
+ * valid record of the newest sector, and a torn record closes its sector
+ * so the next append starts on freshly erased flash.
+ */
+class FlashLog {
+public:
+    FlashLog() :
+        _mounted(false),
+        _sectors(0),
+        _head_sector(0),
+        _head_offset(0),
+        _next_sequence(0),
+        _boot(0),
+        _clear_left(0)
+    {
+        rewind();
+    }
+
+    /**
+     * Locate the log and the append position.
+     *
+     * @param[in] size Bytes of the log, a whole number of sectors.
+     * @param[in] reserved Bytes left alone at the end of the flash, above
+     * the log.
+     * @return false when there is no usable flash region.
+     */
+    bool mount(uint32_t size, uint32_t reserved)
+    {
+#if DEVICE_FLASH
+        if (!size || _flash.init() != 0) {
+            return false;
+        }
+
+        uint32_t flash_start = _flash.get_flash_start();
+        uint32_t end = flash_start + _flash.get_flash_size();
+        if (size + reserved > end - flash_start) {
+            return false;
+        }
+        end -= reserved;
+        _start = end - size;
+        if (_start < FLASHIAP_APP_ROM_END_ADDR) {
+            /* the application image would be erased */
+            return false;
+        }
+
+        _sector_size = _flash.get_sector_size(_start);
+        _page_size = _flash.get_page_size();
+        if (_page_size > log_format::RECORD_MAX || _sector_size < log_format::RECORD_MAX ||
+                size % _sector_size || _start % _sector_size || end % _sector_size) {
+            return false;
+        }
+        _sectors = size / _sector_size;
+
+        /* newest sector is the one starting with the highest sequence */
+        bool found = false;
+        uint32_t newest = 0;
+        uint16_t newest_boot = 0;
+        for (uint32_t s = 0; s < _sectors; s++) {
+            uint8_t header[log_format::HEADER_SIZE];
+            if (read_header(s * _sector_size, header)) {
+                uint32_t sequence = log_format::get_u32(header + 4);
+                if (!found || (int32_t)(sequence - newest) > 0) {
+                    newest = sequence;
+                    newest_boot = log_format::get_u16(header + 12);
+                    _head_sector = s;
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) {
+            /* the first append moves to sector 0 and erases it */
+            _head_sector = _sectors - 1;
+            _head_offset = _sector_size;
+            _mounted = true;
+            return true;
+        }
+
+        /*
+         * Count on from the header of the newest sector even when its first
+         * record is torn: the next sector must not restart from sequence 0,
+         * it would then look older than every other one on the next mount.
+         */
+        _next_sequence = newest + 1;
+        _boot = newest_boot + 1;
+
+        _head_offset = 0;
+        for (;;) {
+            uint8_t header[log_format::HEADER_SIZE];
+            uint32_t address = _head_sector * _sector_size + _head_offset;
+            if (_head_offset + log_format::HEADER_SIZE > _sector_size || !read_header(address, header)) {
+                break;
+            }
+
+            uint16_t length = log_format::HEADER_SIZE + log_format::get_u16(header + 2);
+            _flash.read(_buffer, _start + address, length);
+            uint16_t crc = log_format::crc16(_buffer, log_format::CRC_OFFSET);
+            crc = log_format::crc16(_buffer + log_format::HEADER_SIZE, length - log_format::HEADER_SIZE, crc);
+            if (crc != log_format::get_u16(header + log_format::CRC_OFFSET)) {
+                break;
+            }
+
+            _next_sequence = log_format::get_u32(header + 4) + 1;
+            _boot = log_format::get_u16(header + 12) + 1;
+            _head_offset += padded(length);
+        }
+
+        /* anything but erased flash after the last record is a torn write */
+        if (_head_offset < _sector_size && !is_erased(_head_sector * _sector_size + _head_offset)) {
+            _head_offset = _sector_size;
+        }
+
+        _mounted = true;
+        return true;
+#else
+        (void)size;
+        (void)reserved;
+        return false;
+#endif
+    }
+
+    bool mounted() const
+    {
+        return _mounted;
+    }
+
+    /** Program one record, erasing the next sector when the head is full. */
+    bool append(const SampleBlockEncoder &block)
+    {
+#if DEVICE_FLASH
+        if (!_mounted || _clear_left || !block.count()) {
+            return false;
+        }
+
+        unsigned length = block.finish(_buffer, _next_sequence, _boot);
+        unsigned size = padded(length);
+        memset(_buffer + length, 0xFF, size - length);
+
+        if (_head_offset + size > _sector_size) {
+            _head_sector = (_head_sector + 1) % _sectors;
+            _head_offset = 0;
+            if (_flash.erase(_start + _head_sector * _sector_size, _sector_size) != 0) {
+                return false;
+            }
+        }
+
+        if (_flash.program(_buffer, _start + _head_sector * _sector_size + _head_offset, size) != 0) {
+            /* never program over a failed write */
+            _head_offset = _sector_size;
+            return false;
+        }
+
+        _head_offset += size;
+        _next_sequence++;
+        return true;
+#else
+        (void)block;
+        return false;
+#endif
+    }
+
+    /**
+     * Empty the log, its sectors are erased one per clear_step() so that
+     * no single call blocks for the whole region. Nothing is appended or
+     * read until the last one is erased; sequence numbers keep counting.
+     */
+    void clear()
+    {
+        if (!_mounted) {
+            return;
+        }
+        _clear_left = _sectors;
+        _head_sector = _sectors - 1;
+        _head_offset = _sector_size;
+        rewind();
+    }
+
+    /**
+     * Erase the next sector of a clear().
+     *
+     * @return true while sectors are left to erase.
+     */
+    bool clear_step()
+    {
+        if (!_clear_left) {
+            return false;
+        }
+        _clear_left--;
+#if DEVICE_FLASH
+        _flash.erase(_start + _clear_left * _sector_size, _sector_size);
+#endif
+        return _clear_left != 0;
+    }
+
+    /** Restart read() from the oldest record. */
+    void rewind()
+    {
+        _read_sector = 0;
+        _read_offset = 0;
+        _read_left = 0;
+    }
+
+    /**
+     * Copy the next bytes of the log, records back to back from the oldest
+     * without their flash padding.
+     *
+     * @return Bytes copied, less than max only at the end of the log.
+     */
+    unsigned read(uint8_t *out, unsigned max)
+    {
+        unsigned copied = 0;
+#if DEVICE_FLASH
+        while (copied < max && !_clear_left) {
+            if (!_read_left && !next_record()) {
+                break;
+            }
+
+            unsigned n = (_read_left < max - copied) ? _read_left : max - copied;
+            _flash.read(out + copied, _start + _read_address, n);
+            _read_address += n;
+            _read_left -= n;
+            copied += n;
+        }
+#else
+        (void)out;
+        (void)max;
+#endif
+        return copied;
+    }
+
+private:
+#if DEVICE_FLASH
+    unsigned padded(unsigned length) const
+    {
+        return (length + _page_size - 1) / _page_size * _page_size;
+    }
+
+    bool read_header(uint32_t address, uint8_t *header)
+    {
+        if (_flash.read(header, _start + address, log_format::HEADER_SIZE) != 0) {
+            return false;
+        }
+        return log_format::get_u16(header) == log_format::RECORD_MAGIC &&
+               log_format::get_u16(header + 2) <= log_format::PAYLOAD_MAX;
+    }
+
+    bool is_erased(uint32_t address)
+    {
+        uint8_t magic[2];
+        _flash.read(magic, _start + address, sizeof(magic));
+        return magic[0] == 0xFF && magic[1] == 0xFF;
+    }
+
+    /* Walk the sectors from the one after the head, which holds the oldest data. */
+    bool next_record()
+    {
+        while (_read_sector < _sectors) {
+            uint32_t sector = (_head_sector + 1 + _read_sector) % _sectors;
+            uint32_t limit = (sector == _head_sector) ? _head_offset : _sector_size;
+            uint8_t header[log_format::HEADER_SIZE];
+
+            if (_read_offset + log_format::HEADER_SIZE <= limit &&
+                    read_header(sector * _sector_size + _read_offset, header)) {
+                uint16_t length = log_format::HEADER_SIZE + log_format::get_u16(header + 2);
+                _read_address = sector * _sector_size + _read_offset;
+                _read_left = length;
+                _read_offset += padded(length);
+                return true;
+            }
+
+            _read_sector++;
+            _read_offset = 0;
+        }
+        return false;
+    }
+
+    FlashIAP _flash;
+    uint32_t _start;
+    uint32_t _sector_size;
+    uint32_t _page_size;
+    uint8_t _buffer[log_format::RECORD_MAX];
+#endif
+
+    bool _mounted;
+    uint32_t _sectors;
+    uint32_t _head_sector;
+    uint32_t _head_offset;
+    uint32_t _next_sequence;
+    uint16_t _boot;
+    uint32_t _clear_left;
+
+    uint32_t _read_sector;
+    uint32_t _read_offset;
+    uint32_t _read_address;
+    uint32_t _read_left;
+};
+
+#endif /* SOURCE_FLASHLOG_H_ */
@@ -0,0 +1,154 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATT_SERVER_EXAMPLE_GATT_SERVICE_TABLE_H_
+#define GATT_SERVER_EXAMPLE_GATT_SERVICE_TABLE_H_
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform/NonCopyable.h"
+
+#include "ble/UUID.h"
+#include "ble/GattCharacteristic.h"
+#include "ble/GattService.h"
+
+/*
+ * Bytes of a 128 bit UUID, most significant first, from the fields of its
+ * string form: GATT_UUID128(0x51311102, 0x030e, 0x485f, 0xb122, 0xf8f3, 0x81aa84ed)
+ * is "51311102-030e-485f-b122-f8f381aa84ed". The bytes are constant
+ * expressions, a table of them is initialized by the linker and stays in
+ * flash, unlike a UUID parsed from a string at run time.
+ */
+#define GATT_UUID128(time_low, time_mid, time_hi, clock_seq, node_hi, node_lo) { \
+    (uint8_t)((time_low) >> 24), (uint8_t)((time_low) >> 16),                 \
+    (uint8_t)((time_low) >> 8), (uint8_t)(time_low),                           \
+    (uint8_t)((time_mid) >> 8), (uint8_t)(time_mid),                           \
+    (uint8_t)((time_hi) >> 8), (uint8_t)(time_hi),                             \
+    (uint8_t)((clock_seq) >> 8), (uint8_t)(clock_seq),                         \
+    (uint8_t)((node_hi) >> 8), (uint8_t)(node_hi),                             \
+    (uint8_t)((node_lo) >> 24), (uint8_t)((node_lo) >> 16),                    \
+    (uint8_t)((node_lo) >> 8), (uint8_t)(node_lo)                              \
+}
+
+/**
+ * Immutable description of a characteristic, meant for a static const table.
+ */
+struct GattCharacteristicDef {
+    UUID::LongUUIDBytes_t uuid;
+    uint16_t max_length;
+    uint8_t properties;
+    bool variable_length;
+};
+
+/**
+ * Service built from a table of N characteristic definitions.
+ *
+ * The definitions stay in flash; only the GattCharacteristic objects and the
+ * GattService the stack works with live in RAM, constructed in place by
+ * build() without heap allocation. Their values are buffers of the owner,
+ * sized max_length.
+ *
+ * The service built is registered by the caller, e.g. through a
+ * GattServerDispatcher which routes the events of its characteristics.
+ */
+template<size_t N>
+class GattServiceTable : private mbed::NonCopyable<GattServiceTable<N> > {
+public:
+    GattServiceTable() : _built(false) { }
+
+    ~GattServiceTable()
+    {
+        if (!_built) {
+            return;
+        }
+        service().~GattService();
+        for (size_t i = 0; i < N; ++i) {
+            characteristic(i).~GattCharacteristic();
+        }
+    }
+
+    /**
+     * Build the characteristics and the service from their definitions, once.
+     */
+    GattService &build(
+        const UUID::LongUUIDBytes_t service_uuid,
+        const GattCharacteristicDef (&definitions)[N],
+        uint8_t *const (&values)[N]
+    ) {
+        if (_built) {
+            return service();
+        }
+
+        for (size_t i = 0; i < N; ++i) {
+            const GattCharacteristicDef &definition = definitions[i];
+            _characteristics[i] = new (_characteristic_storage[i].bytes) GattCharacteristic(
+                UUID(definition.uuid, UUID::MSB),
+                values[i],
+                definition.max_length,
+                definition.max_length,
+                definition.properties,
+                /* descriptors */ NULL,
+                /* descriptor count */ 0,
+                definition.variable_length
+            );
+        }
+        new (_service_storage.bytes) GattService(
+            UUID(service_uuid, UUID::MSB), _characteristics, N
+        );
+        _built = true;
+
+        return service();
+    }
+
+    GattService &service()
+    {
+        return *reinterpret_cast<GattService *>(_service_storage.bytes);
+    }
+
+    GattCharacteristic &characteristic(size_t index)
+    {
+        return *reinterpret_cast<GattCharacteristic *>(_characteristic_storage[index].bytes);
+    }
+
+    GattAttribute::Handle_t value_handle(size_t index)
+    {
+        return characteristic(index).getValueHandle();
+    }
+
+private:
+    /* raw storage aligned for a GattCharacteristic */
+    union CharacteristicSlot {
+        uint8_t bytes[sizeof(GattCharacteristic)];
+        void *pointer;
+        uint64_t word;
+    };
+
+    /* raw storage aligned for a GattService */
+    union ServiceSlot {
+        uint8_t bytes[sizeof(GattService)];
+        void *pointer;
+        uint64_t word;
+    };
+
+    CharacteristicSlot _characteristic_storage[N];
+    ServiceSlot _service_storage;
+    GattCharacteristic *_characteristics[N];
+    bool _built;
+};
+
+#endif /* GATT_SERVER_EXAMPLE_GATT_SERVICE_TABLE_H_ */
@@ -0,0 +1,170 @@
+/*
+ * ImuFusion.h
+ *
+ * Fixed-point Mahony complementary filter fed with raw LSM6DS3 samples.
+ */
+
+#ifndef SOURCE_IMUFUSION_H_
+#define SOURCE_IMUFUSION_H_
+
+#include <stdint.h>
+#include "FixedPoint.h"
+
+/**
+ * Orientation estimator running at the IMU output data rate.
+ *
+ * The quaternion is kept in Q2.30 and every step uses integer arithmetic
+ * only: the gyro rate is turned into a half-angle increment per sample and
+ * the accelerometer direction pulls the estimate toward gravity with a
+ * proportional/integral correction.
+ */
+class ImuFusion {
+public:
+    static const int32_t ONE = 1 << 30;
+
+    /**
+     * @param[in] odr_hz Rate at which update() is called.
+     * @param[in] gyro_range_dps Full scale of the gyroscope (125 to 2000).
+     * @param[in] kp_q24 Proportional gain in Q8.24 (1 << 24 is 1.0).
+     * @param[in] ki_q24 Integral gain in Q8.24.
+     */
+    ImuFusion(uint16_t odr_hz, uint16_t gyro_range_dps,
+              int32_t kp_q24 = 1 << 24, int32_t ki_q24 = 0) :
+        _half_dt_q24(0),
+        _kp_step_q24(0),
+        _ki_step_q24(0),
+        _gyro_step(0)
+    {
+        configure(odr_hz, gyro_range_dps, kp_q24, ki_q24);
+        reset();
+    }
+
+    void configure(uint16_t odr_hz, uint16_t gyro_range_dps, int32_t kp_q24, int32_t ki_q24)
+    {
+        /* gyro sensitivity in micro dps per LSB, 4.375 mdps at 125 dps */
+        uint32_t sens_udps = (gyro_range_dps == 245) ? 8750 : 4375 * (gyro_range_dps / 125);
+
+        /* half-angle increment per LSB and per sample, in Q38:
+         * 0.5 * sens * 1e-6 * pi / 180 / odr * 2^38 = sens * 2398.76 / odr */
+        _gyro_step = (int32_t)(((uint64_t)sens_udps * 157205283ULL / odr_hz) >> 16);
+
+        _half_dt_q24 = (1 << 24) / (2 * odr_hz);
+        _kp_step_q24 = kp_q24 / (2 * odr_hz);
+        _ki_step_q24 = ki_q24 / odr_hz;
+    }
+
+    void reset()
+    {
+        _q[0] = ONE;
+        _q[1] = _q[2] = _q[3] = 0;
+        _integral[0] = _integral[1] = _integral[2] = 0;
+    }
+
+    /**
+     * Advance the estimate by one sample.
+     *
+     * @param[in] gyro Raw gyroscope sample {X, Y, Z}.
+     * @param[in] accel Raw accelerometer sample {X, Y, Z}.
+     */
+    void update(const int16_t *gyro, const int16_t *accel)
+    {
+        int32_t h[3];
+        for (int i = 0; i < 3; i++) {
+            h[i] = (int32_t)(((int64_t)gyro[i] * _gyro_step) >> 8);
+        }
+
+        int32_t a[3];
+        if (normalize_accel(accel, a)) {
+            /* gravity direction predicted by the current estimate */
+            int32_t v[3];
+            v[0] = 2 * (mul(_q[1], _q[3]) - mul(_q[0], _q[2]));
+            v[1] = 2 * (mul(_q[0], _q[1]) + mul(_q[2], _q[3]));
+            v[2] = mul(_q[0], _q[0]) - mul(_q[1], _q[1]) - mul(_q[2], _q[2]) + mul(_q[3], _q[3]);
+
+            int32_t e[3];
+            e[0] = mul(a[1], v[2]) - mul(a[2], v[1]);
+            e[1] = mul(a[2], v[0]) - mul(a[0], v[2]);
+            e[2] = mul(a[0], v[1]) - mul(a[1], v[0]);
+
+            for (int i = 0; i < 3; i++) {
+                _integral[i] += mul_q24(e[i], _ki_step_q24);
+                h[i] += mul_q24(e[i], _kp_step_q24) + mul_q24(_integral[i], _half_dt_q24);
+            }
+        }
+
+        int32_t q0 = _q[0], q1 = _q[1], q2 = _q[2], q3 = _q[3];
+        _q[0] += -mul(q1, h[0]) - mul(q2, h[1]) - mul(q3, h[2]);
+        _q[1] +=  mul(q0, h[0]) + mul(q2, h[2]) - mul(q3, h[1]);
+        _q[2] +=  mul(q0, h[1]) - mul(q1, h[2]) + mul(q3, h[0]);
+        _q[3] +=  mul(q0, h[2]) + mul(q1, h[1]) - mul(q2, h[0]);
+
+        /* one Newton step toward unit norm: q *= (3 - |q|^2) / 2 */
+        int64_t n2 = 0;
+        for (int i = 0; i < 4; i++) {
+            n2 += ((int64_t)_q[i] * _q[i]) >> 30;
+        }
+        int64_t factor = ((3LL << 30) - n2) >> 1;
+        for (int i = 0; i < 4; i++) {
+            _q[i] = (int32_t)(((int64_t)_q[i] * factor) >> 30);
+        }
+    }
+
+    /** Current quaternion {w, x, y, z} in Q2.30. */
+    const int32_t *quaternion() const
+    {
+        return _q;
+    }
+
+    /**
+     * Vector part of the quaternion scaled by 10000, as used by the BlueST
+     * compact sensor fusion format. The sign is chosen so that w >= 0, the
+     * receiver rebuilds w from the unit norm.
+     */
+    void getBlueSTVector(int16_t *qv) const
+    {
+        int64_t sign = (_q[0] < 0) ? -1 : 1;
+        for (int i = 0; i < 3; i++) {
+            qv[i] = (int16_t)((sign * _q[i + 1] * 10000) >> 30);
+        }
+    }
+
+private:
+    static int32_t mul(int32_t a, int32_t b)
+    {
+        return (int32_t)(((int64_t)a * b) >> 30);
+    }
+
+    static int32_t mul_q24(int32_t a, int32_t b)
+    {
+        return (int32_t)(((int64_t)a * b) >> 24);
+    }
+
+    /* Scale the accelerometer vector to unit length in Q2.30, skip near free fall. */
+    static bool normalize_accel(const int16_t *accel, int32_t *a)
+    {
+        uint32_t n2 = 0;
+        for (int i = 0; i < 3; i++) {
+            n2 += (uint32_t)((int32_t)accel[i] * accel[i]);
+        }
+
+        uint32_t norm = isqrt32(n2);
+        if (norm < 256) {
+            return false;
+        }
+
+        int64_t inv = (1LL << 45) / norm;
+        for (int i = 0; i < 3; i++) {
+            a[i] = (int32_t)((accel[i] * inv) >> 15);
+        }
+        return true;
+    }
+
+    int32_t _q[4];
+    int32_t _integral[3];
+    int32_t _half_dt_q24;
+    int32_t _kp_step_q24;
+    int32_t _ki_step_q24;
+    int32_t _gyro_step;
+};
+
+#endif /* SOURCE_IMUFUSION_H_ */
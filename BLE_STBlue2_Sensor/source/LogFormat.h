@@ -0,0 +1,161 @@
+/*
+ * LogFormat.h
+ *
+ * Record layout of the offline sensor log, shared by the flash log and
+ * the download path. tools/read_log.py is the host side reader.
+ */
+
+#ifndef SOURCE_LOGFORMAT_H_
+#define SOURCE_LOGFORMAT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace log_format {
+
+/*
+ * Every record is a little endian header followed by the payload:
+ *
+ *   0  magic       uint16  RECORD_MAGIC
+ *   2  length      uint16  payload bytes
+ *   4  sequence    uint32  increments with every record, across reboots
+ *   8  timestamp   uint32  ms since boot of the first sample
+ *  12  boot        uint16  boot counter
+ *  14  interval    uint16  ms between two samples
+ *  16  channels    uint8
+ *  17  count       uint8   samples in the block
+ *  18  crc         uint16  CRC-16/CCITT of bytes 0..17 and the payload
+ *
+ * The payload holds the first sample, then the difference of every sample
+ * with the previous one, channel by channel, each value zigzag encoded as
+ * a LEB128 varint (1 to 3 bytes).
+ */
+static const uint16_t RECORD_MAGIC = 0xB10C;
+static const unsigned HEADER_SIZE = 20;
+static const unsigned CRC_OFFSET = 18;
+static const unsigned RECORD_MAX = 256;
+static const unsigned PAYLOAD_MAX = RECORD_MAX - HEADER_SIZE;
+
+inline uint16_t crc16(const uint8_t *data, unsigned length, uint16_t crc = 0xFFFF)
+{
+    while (length--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+inline void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+}
+
+inline void put_u32(uint8_t *out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+inline uint16_t get_u16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+inline uint32_t get_u32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+} // namespace log_format
+
+/**
+ * Builds one delta compressed record of multi-channel samples.
+ */
+class SampleBlockEncoder {
+public:
+    static const unsigned MAX_CHANNELS = 8;
+
+    SampleBlockEncoder() : _channels(0), _count(0), _size(0) { }
+
+    void start(uint32_t timestamp_ms, uint16_t interval_ms, uint8_t channels)
+    {
+        _timestamp_ms = timestamp_ms;
+        _interval_ms = interval_ms;
+        _channels = (channels > MAX_CHANNELS) ? MAX_CHANNELS : channels;
+        _count = 0;
+        _size = 0;
+    }
+
+    /**
+     * Append one sample of every channel.
+     *
+     * @return false when the block is full, the sample is not added.
+     */
+    bool add(const int16_t *values)
+    {
+        /* a 17 bit zigzag delta takes at most 3 varint bytes */
+        if (_count == UINT8_MAX || _size + 3u * _channels > log_format::PAYLOAD_MAX) {
+            return false;
+        }
+
+        for (unsigned c = 0; c < _channels; c++) {
+            int32_t v = _count ? (int32_t)values[c] - _previous[c] : values[c];
+            uint32_t zigzag = (v < 0) ? ((uint32_t)(-v) << 1) - 1 : (uint32_t)v << 1;
+            do {
+                uint8_t byte = zigzag & 0x7F;
+                zigzag >>= 7;
+                _payload[_size++] = zigzag ? (byte | 0x80) : byte;
+            } while (zigzag);
+            _previous[c] = values[c];
+        }
+        _count++;
+        return true;
+    }
+
+    uint8_t count() const
+    {
+        return _count;
+    }
+
+    /**
+     * Write the complete record.
+     *
+     * @param[out] out At least log_format::RECORD_MAX bytes.
+     * @return Record length in bytes.
+     */
+    unsigned finish(uint8_t *out, uint32_t sequence, uint16_t boot) const
+    {
+        using namespace log_format;
+
+        put_u16(out, RECORD_MAGIC);
+        put_u16(out + 2, _size);
+        put_u32(out + 4, sequence);
+        put_u32(out + 8, _timestamp_ms);
+        put_u16(out + 12, boot);
+        put_u16(out + 14, _interval_ms);
+        out[16] = _channels;
+        out[17] = _count;
+        memcpy(out + HEADER_SIZE, _payload, _size);
+
+        uint16_t crc = crc16(out, CRC_OFFSET);
+        crc = crc16(_payload, _size, crc);
+        put_u16(out + CRC_OFFSET, crc);
+
+        return HEADER_SIZE + _size;
+    }
+
+private:
+    uint32_t _timestamp_ms;
+    uint16_t _interval_ms;
+    uint8_t _channels;
+    uint8_t _count;
+    uint16_t _size;
+    int16_t _previous[MAX_CHANNELS];
+    uint8_t _payload[log_format::PAYLOAD_MAX];
+};
+
+#endif /* SOURCE_LOGFORMAT_H_ */
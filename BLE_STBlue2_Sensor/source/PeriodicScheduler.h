@@ -0,0 +1,241 @@
+/*
+ * PeriodicScheduler.h
+ *
+ * Timer coalescing for the periodic work of the application.
+ */
+
+#ifndef SOURCE_PERIODICSCHEDULER_H_
+#define SOURCE_PERIODICSCHEDULER_H_
+
+#include <mbed.h>
+#include <events/mbed_events.h>
+#include "QueueMonitor.h"
+
+/**
+ * Runs periodic tasks from a single queue event instead of one timer each.
+ *
+ * All deadlines are taken on a common time base, so harmonic periods fall
+ * on the same ticks. A task may run up to its tolerance after its deadline:
+ * the next wakeup is the earliest deadline plus tolerance over all tasks,
+ * and every task already due at that point runs in the same wakeup. The
+ * deadlines stay on their grid, lateness never accumulates into drift, and
+ * missed periods are skipped rather than run back to back.
+ *
+ * Between wakeups the queue has nothing to do and the idle loop sleeps;
+ * the sleep is deep only when the event queue runs on the low power ticker
+ * (events.use-lowpower-timer-ticker on targets that have one).
+ *
+ * An external periodic wakeup, such as an interrupt-driven acquisition
+ * tick started together with the scheduler, can be shared as well: after
+ * attachTick() every task whose period is a multiple of the tick runs from
+ * tick(), posted by that wakeup, and the timer only serves the other ones.
+ * Tick tasks are counted in ticks rather than compared with the clock, so
+ * they stay on the tick however late the post is dispatched.
+ *
+ * With coalescing off every task gets its own call_every(), the wakeups
+ * are then counted the same way for comparison.
+ */
+class PeriodicScheduler {
+public:
+    static const unsigned MAX_TASKS = 10;
+    /* re-arms the wakeup should its post ever fail on an exhausted pool */
+    static const int WATCHDOG_MS = 10000;
+
+    PeriodicScheduler(events::EventQueue &queue, QueueMonitor &monitor, bool coalesce) :
+        _queue(queue),
+        _monitor(monitor),
+        _coalesce(coalesce),
+        _tasks(0),
+        _tick_ms(0),
+        _ticks(0),
+        _started(false),
+        _armed(false),
+        _wakeups(0),
+        _runs(0)
+    {
+        if (_coalesce) {
+            _monitor.addTask("scheduler");
+        }
+    }
+
+    /** Share the wakeups of a tick of tick_ms, before add(). */
+    void attachTick(uint32_t tick_ms)
+    {
+        if (!_tasks) {
+            _tick_ms = tick_ms;
+        }
+    }
+
+    /**
+     * Register a task, before start().
+     *
+     * @param[in] tolerance_ms How late the task may run, less than the period.
+     * @return false when the table is full or the scheduler already started.
+     */
+    bool add(const char *name, uint32_t period_ms, uint32_t tolerance_ms, mbed::Callback<void()> callback)
+    {
+        if (_started || _tasks == MAX_TASKS || !period_ms) {
+            return false;
+        }
+        _monitor.addTask(name);
+
+        Task &task = _task[_tasks++];
+        task.scheduler = this;
+        task.name = name;
+        task.callback = callback;
+        task.period_ms = period_ms;
+        task.tolerance_ms = (tolerance_ms < period_ms) ? tolerance_ms : period_ms - 1;
+        task.tick_period = (_coalesce && _tick_ms && !(period_ms % _tick_ms)) ? period_ms / _tick_ms : 0;
+        return true;
+    }
+
+    template <typename T, typename M>
+    bool add(const char *name, uint32_t period_ms, uint32_t tolerance_ms, T *obj, M method)
+    {
+        return add(name, period_ms, tolerance_ms, mbed::callback(obj, method));
+    }
+
+    /** First deadlines one period from now, all on the same time base. */
+    void start()
+    {
+        if (_started) {
+            return;
+        }
+        _started = true;
+
+        if (!_coalesce) {
+            for (unsigned i = 0; i < _tasks; i++) {
+                _monitor.call_every(_task[i].name, _task[i].period_ms, &_task[i], &Task::run_alone);
+            }
+            return;
+        }
+
+        uint32_t now = _queue.tick();
+        for (unsigned i = 0; i < _tasks; i++) {
+            _task[i].due_ms = now + _task[i].period_ms;
+        }
+        _queue.call_every(WATCHDOG_MS, this, &PeriodicScheduler::watchdog);
+        arm(now);
+    }
+
+    /**
+     * Run the tick tasks due on this tick, from the thread context event
+     * posted by the external wakeup. It is counted as a wakeup.
+     */
+    void tick()
+    {
+        _wakeups++;
+        if (!_started || !_coalesce) {
+            return;
+        }
+
+        _ticks++;
+        for (unsigned i = 0; i < _tasks; i++) {
+            Task &task = _task[i];
+            if (task.tick_period && !(_ticks % task.tick_period)) {
+                _monitor.runPeriodic(task.name, task.period_ms, mbed::callback(&task, &Task::run));
+            }
+        }
+    }
+
+    /** Wakeups taken so far, the figure coalescing brings down. */
+    uint32_t wakeups() const
+    {
+        return _wakeups;
+    }
+
+    /** Task runs so far, one wakeup each without coalescing. */
+    uint32_t runs() const
+    {
+        return _runs;
+    }
+
+private:
+    struct Task {
+        PeriodicScheduler *scheduler;
+        const char *name;
+        mbed::Callback<void()> callback;
+        uint32_t period_ms;
+        uint32_t tolerance_ms;
+        uint32_t due_ms;
+        /* ticks per period of a task run from tick(), 0 for the timer */
+        uint32_t tick_period;
+
+        void run()
+        {
+            scheduler->_runs++;
+            callback();
+        }
+
+        void run_alone()
+        {
+            scheduler->_wakeups++;
+            run();
+        }
+    };
+
+    void wake()
+    {
+        _armed = false;
+        _wakeups++;
+
+        uint32_t now = _queue.tick();
+        for (unsigned i = 0; i < _tasks; i++) {
+            Task &task = _task[i];
+            if (task.tick_period || (int32_t)(now - task.due_ms) < 0) {
+                continue;
+            }
+
+            _monitor.runPeriodic(task.name, task.period_ms, mbed::callback(&task, &Task::run));
+            do {
+                task.due_ms += task.period_ms;
+            } while ((int32_t)(now - task.due_ms) >= 0);
+        }
+
+        arm(_queue.tick());
+    }
+
+    /* the latest wakeup that still meets every deadline within its tolerance */
+    void arm(uint32_t now)
+    {
+        bool found = false;
+        uint32_t wake_ms = 0;
+        for (unsigned i = 0; i < _tasks; i++) {
+            if (_task[i].tick_period) {
+                continue;
+            }
+            uint32_t latest = _task[i].due_ms + _task[i].tolerance_ms;
+            if (!found || (int32_t)(latest - wake_ms) < 0) {
+                wake_ms = latest;
+                found = true;
+            }
+        }
+        if (!found) {
+            return;
+        }
+
+        int32_t delay = (int32_t)(wake_ms - now);
+        _armed = _monitor.call_in("scheduler", (delay > 0) ? delay : 0, this, &PeriodicScheduler::wake) != 0;
+    }
+
+    void watchdog()
+    {
+        if (!_armed) {
+            arm(_queue.tick());
+        }
+    }
+
+    events::EventQueue &_queue;
+    QueueMonitor &_monitor;
+    bool _coalesce;
+    Task _task[MAX_TASKS];
+    unsigned _tasks;
+    uint32_t _tick_ms;
+    uint32_t _ticks;
+    bool _started;
+    bool _armed;
+    uint32_t _wakeups;
+    uint32_t _runs;
+};
+
+#endif /* SOURCE_PERIODICSCHEDULER_H_ */
@@ -0,0 +1,312 @@
+/*
+ * QueueMonitor.h
+ *
+ * Dispatch instrumentation of the application event queue.
+ */
+
+#ifndef SOURCE_QUEUEMONITOR_H_
+#define SOURCE_QUEUEMONITOR_H_
+
+#include <mbed.h>
+#include <events/mbed_events.h>
+
+/**
+ * Posts callbacks to an EventQueue through a per task trampoline timed with
+ * the microsecond ticker, and records:
+ *
+ * - the execution time of every run, average and maximum;
+ * - the start jitter of periodic tasks, how far the interval between two
+ *   runs strays from the nominal period;
+ * - the dispatch latency of one-shot and delayed calls, from the due time
+ *   to the start of the callback;
+ * - the queue depth (periodic events plus one-shots not dispatched yet)
+ *   and its high-water mark;
+ * - allocation failures, the posts refused because the pool is exhausted.
+ *
+ * A task is a name, a string literal, standing for one callback. Names are
+ * given a slot by addTask() from thread context at startup, so that posts
+ * from interrupt context only look them up. The calls of other names go to
+ * the queue as they are, only allocation failures are counted for them.
+ * The callback travels with the event, a task posted again before it ran
+ * keeps both callbacks.
+ *
+ * Task statistics cover the window since the last closeWindow(), the queue
+ * figures are kept since boot.
+ */
+class QueueMonitor {
+public:
+    static const unsigned MAX_TASKS = 20;
+
+    struct TaskStats {
+        const char *name;
+        uint32_t period_ms;       /* 0 for one-shot tasks */
+        uint32_t runs;
+        uint32_t exec_total_us;
+        uint32_t exec_max_us;
+        uint32_t jitter_max_us;
+        uint32_t latency_max_us;
+    };
+
+    QueueMonitor(events::EventQueue &queue, const char *name = "Queue") :
+        _queue(queue),
+        _name(name),
+        _tasks(0),
+        _depth(0),
+        _high_water(0),
+        _posts(0),
+        _alloc_failures(0)
+    {
+    }
+
+    /**
+     * Give name a slot, from thread context before its first post.
+     *
+     * @return false past MAX_TASKS names.
+     */
+    bool addTask(const char *name)
+    {
+        if (find(name)) {
+            return true;
+        }
+        if (_tasks == MAX_TASKS) {
+            return false;
+        }
+
+        Task *task = &_task[_tasks];
+        task->monitor = this;
+        task->stats.name = name;
+        task->stats.period_ms = 0;
+        task->started = false;
+        task->clear();
+        _tasks++;
+        return true;
+    }
+
+    /** Post a one-shot call, it may be called from interrupt context. */
+    int call(const char *name, mbed::Callback<void()> callback)
+    {
+        return post(name, callback, 0);
+    }
+
+    template <typename T, typename M>
+    int call(const char *name, T *obj, M method)
+    {
+        return call(name, mbed::callback(obj, method));
+    }
+
+    /** Post a call due in delay_ms, its latency is counted from then. */
+    int call_in(const char *name, int delay_ms, mbed::Callback<void()> callback)
+    {
+        return post(name, callback, delay_ms);
+    }
+
+    template <typename T, typename M>
+    int call_in(const char *name, int delay_ms, T *obj, M method)
+    {
+        return call_in(name, delay_ms, mbed::callback(obj, method));
+    }
+
+    int call_every(const char *name, int period_ms, mbed::Callback<void()> callback)
+    {
+        Task *task = find(name);
+        if (!task) {
+            return count_failure(_queue.call_every(period_ms, callback));
+        }
+        task->stats.period_ms = period_ms;
+
+        int id = _queue.call_every(period_ms, task, &Task::run_periodic, callback);
+        count_post(id);
+        return id;
+    }
+
+    template <typename T, typename M>
+    int call_every(const char *name, int period_ms, T *obj, M method)
+    {
+        return call_every(name, period_ms, mbed::callback(obj, method));
+    }
+
+    /** Run a periodic task now, from an event that dispatches several of them. */
+    void runPeriodic(const char *name, uint32_t period_ms, mbed::Callback<void()> callback)
+    {
+        Task *task = find(name);
+        if (!task) {
+            callback();
+            return;
+        }
+        task->stats.period_ms = period_ms;
+        task->run_periodic(callback);
+    }
+
+    unsigned tasks() const
+    {
+        return _tasks;
+    }
+
+    const TaskStats &task(unsigned index) const
+    {
+        return _task[index].stats;
+    }
+
+    uint32_t depth() const
+    {
+        return _depth;
+    }
+
+    uint32_t highWater() const
+    {
+        return _high_water;
+    }
+
+    uint32_t posts() const
+    {
+        return _posts;
+    }
+
+    uint32_t allocFailures() const
+    {
+        return _alloc_failures;
+    }
+
+    /** Copy the task statistics of the window to out and start a new one. */
+    void closeWindow(TaskStats *out)
+    {
+        for (unsigned i = 0; i < _tasks; i++) {
+            out[i] = _task[i].stats;
+            _task[i].clear();
+        }
+    }
+
+    /** Print the queue figures and the given window on the serial port. */
+    void print(const TaskStats *window) const
+    {
+        printf("%s: depth %lu, high-water %lu, %lu posts, %lu alloc failures\r\n",
+               _name, (unsigned long)_depth, (unsigned long)_high_water,
+               (unsigned long)_posts, (unsigned long)_alloc_failures);
+
+        for (unsigned i = 0; i < _tasks; i++) {
+            const TaskStats &s = window[i];
+            printf("  %-12s %5lu runs, exec avg %lu max %lu us, jitter %lu us, latency %lu us\r\n",
+                   s.name, (unsigned long)s.runs,
+                   (unsigned long)(s.runs ? s.exec_total_us / s.runs : 0),
+                   (unsigned long)s.exec_max_us, (unsigned long)s.jitter_max_us,
+                   (unsigned long)s.latency_max_us);
+        }
+    }
+
+private:
+    struct Task {
+        QueueMonitor *monitor;
+        TaskStats stats;
+        bool started;
+        uint32_t last_start_us;
+
+        void clear()
+        {
+            stats.runs = 0;
+            stats.exec_total_us = 0;
+            stats.exec_max_us = 0;
+            stats.jitter_max_us = 0;
+            stats.latency_max_us = 0;
+        }
+
+        void run_posted(mbed::Callback<void()> callback, uint32_t due_us)
+        {
+            uint32_t start = us_ticker_read();
+            core_util_atomic_decr_u32(&monitor->_depth, 1);
+
+            int32_t latency = (int32_t)(start - due_us);
+            if (latency > 0 && (uint32_t)latency > stats.latency_max_us) {
+                stats.latency_max_us = latency;
+            }
+            run(callback, start);
+        }
+
+        void run_periodic(mbed::Callback<void()> callback)
+        {
+            uint32_t start = us_ticker_read();
+            if (started) {
+                int32_t jitter = (int32_t)(start - last_start_us - stats.period_ms * 1000);
+                uint32_t deviation = (jitter < 0) ? -jitter : jitter;
+                if (deviation > stats.jitter_max_us) {
+                    stats.jitter_max_us = deviation;
+                }
+            }
+            started = true;
+            last_start_us = start;
+            run(callback, start);
+        }
+
+        void run(mbed::Callback<void()> callback, uint32_t start_us)
+        {
+            callback();
+
+            uint32_t exec = us_ticker_read() - start_us;
+            stats.runs++;
+            stats.exec_total_us += exec;
+            if (exec > stats.exec_max_us) {
+                stats.exec_max_us = exec;
+            }
+        }
+    };
+
+    /** Read only, safe from interrupt context once the names are added. */
+    Task *find(const char *name)
+    {
+        for (unsigned i = 0; i < _tasks; i++) {
+            if (_task[i].stats.name == name || !strcmp(_task[i].stats.name, name)) {
+                return &_task[i];
+            }
+        }
+        return NULL;
+    }
+
+    int post(const char *name, mbed::Callback<void()> callback, int delay_ms)
+    {
+        Task *task = find(name);
+        if (!task) {
+            return count_failure(delay_ms ? _queue.call_in(delay_ms, callback) : _queue.call(callback));
+        }
+
+        uint32_t due = us_ticker_read() + delay_ms * 1000;
+        int id = delay_ms ? _queue.call_in(delay_ms, task, &Task::run_posted, callback, due)
+                          : _queue.call(task, &Task::run_posted, callback, due);
+        count_post(id);
+        return id;
+    }
+
+    int count_failure(int id)
+    {
+        if (!id) {
+            core_util_atomic_incr_u32(&_alloc_failures, 1);
+        }
+        return id;
+    }
+
+    void count_post(int id)
+    {
+        if (!count_failure(id)) {
+            return;
+        }
+
+        core_util_atomic_incr_u32(&_posts, 1);
+
+        /* a post from an interrupt must not come between the compare and the store */
+        core_util_critical_section_enter();
+        uint32_t depth = ++_depth;
+        if (depth > _high_water) {
+            _high_water = depth;
+        }
+        core_util_critical_section_exit();
+    }
+
+    events::EventQueue &_queue;
+    const char *_name;
+    Task _task[MAX_TASKS];
+    unsigned _tasks;
+    volatile uint32_t _depth;
+    uint32_t _high_water;
+    volatile uint32_t _posts;
+    volatile uint32_t _alloc_failures;
+};
+
+#endif /* SOURCE_QUEUEMONITOR_H_ */
@@ -13,43 +13,286 @@
 #include "BluenrgSensorService.h"
 #include "pretty_printer.h"
 #include "LSM6DS3.h"
+#include "ImuFusion.h"
+#include "WindowStats.h"
+#include "VibrationAnalyzer.h"
+#include "CycleCounter.h"
+#include "DecimationFilter.h"
+#include "DeadbandFilter.h"
+#include "FlashLog.h"
+#include "BulkTransfer.h"
+#include "QueueMonitor.h"
+#include "PeriodicScheduler.h"
+#include "SpscRing.h"
+#include "StackTicker.h"
+#include "BLEEventPump.h"
 
 #ifdef BLUENRG2_DEVICE
 #include "bluenrg1_stack.h"
 #endif //BLUENRG2_DEVICE
 
 const static char DEVICE_NAME[] = "MBED_SENSOR";
-const uint8_t data[] = {0x01,0x02,0x00,0xD4,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
+const uint8_t data[] = {0x01,0x02,0x00,0xD4,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
 const unsigned char passkey[] = "123456";
 
-class SensorDemo : ble::Gap::EventHandler {
+/* IMU output data rate, fusion runs on every FIFO sample at this rate */
+const uint16_t IMU_ODR_HZ = 833;
+const uint16_t IMU_GYRO_RANGE_DPS = 2000;
+
+/* FIFO data set is {Gx, Gy, Gz, XLx, XLy, XLz}, 50 ms at 833 Hz are 42 of them */
+const uint16_t IMU_FIFO_SET_WORDS = 6;
+const uint16_t IMU_FIFO_BLOCK_SETS = 48;
+
+/* Rate conversion of the accel/gyro characteristic, the BLE rate is IMU_ODR_HZ / (CIC x FIR) */
+const uint16_t IMU_CIC_DECIMATION = MBED_CONF_APP_IMU_CIC_DECIMATION;
+const uint16_t IMU_FIR_DECIMATION = MBED_CONF_APP_IMU_FIR_DECIMATION;
+
+/* The quaternion characteristic is notified every QUAT_DECIMATION IMU reports */
+const uint8_t QUAT_DECIMATION = MBED_CONF_APP_QUAT_DECIMATION;
+
+/*
+ * Report by exception: temperature, accel/gyro, the quaternion and the
+ * statistics windows are only notified when they leave their deadband or
+ * when the heartbeat expires. A statistics window is compared through the
+ * means of its streams.
+ */
+const uint32_t ENV_POLL_MS = 1000;
+const uint16_t ENV_DEADBAND = MBED_CONF_APP_ENV_DEADBAND;
+const uint32_t ENV_HEARTBEAT_MS = MBED_CONF_APP_ENV_HEARTBEAT_MS;
+const uint16_t IMU_ACCEL_DEADBAND = MBED_CONF_APP_IMU_ACCEL_DEADBAND;
+const uint16_t IMU_GYRO_DEADBAND = MBED_CONF_APP_IMU_GYRO_DEADBAND;
+const uint32_t IMU_HEARTBEAT_MS = MBED_CONF_APP_IMU_HEARTBEAT_MS;
+const uint16_t QUAT_DEADBAND = MBED_CONF_APP_QUAT_DEADBAND;
+/* the statistics temperature stream is raw, 16 LSB per degree */
+const uint16_t STATS_TEMP_DEADBAND = ENV_DEADBAND * 16 / 10;
+
+/*
+ * Offline log: while no central is connected, the filtered accel/gyro and
+ * the raw temperature are sampled every LOG_INTERVAL_MS into delta
+ * compressed blocks appended to the flash log. In shock capture mode the
+ * IMU FIFO is kept for the capture and nothing filters accel/gyro, the
+ * blocks then hold the temperature alone. A central downloads the log by
+ * writing LOG_COMMAND_DOWNLOAD to the log characteristic, or
+ * LOG_COMMAND_DOWNLOAD_PLAIN to receive the same payload over plain
+ * notifications and compare the throughput.
+ */
+const uint32_t LOG_FLASH_SIZE = MBED_CONF_APP_LOG_FLASH_SIZE;
+const uint32_t LOG_FLASH_RESERVED = MBED_CONF_APP_LOG_FLASH_RESERVED;
+const uint16_t LOG_INTERVAL_MS = MBED_CONF_APP_LOG_INTERVAL_MS;
+const uint8_t LOG_CHANNELS = 7;
+enum {
+    LOG_COMMAND_DOWNLOAD = 0x01,
+    LOG_COMMAND_CLEAR = 0x02,
+    LOG_COMMAND_DOWNLOAD_PLAIN = 0x03
+};
+
+/*
+ * Shock windows and log downloads go out as BulkTransfer segments filling
+ * the negotiated ATT MTU, BULK_CREDITS notifications in flight.
+ */
+const uint8_t BULK_CREDITS = MBED_CONF_APP_BULK_CREDITS;
+
+/* Event queue report on the serial port and the diagnostics characteristic, 0 to disable */
+const uint32_t QUEUE_STATS_MS = MBED_CONF_APP_QUEUE_STATS_MS;
+
+/*
+ * Periodic work shares the wakeups of the coalescing scheduler, every task
+ * may run up to its tolerance late. The IMU FIFO buffers well beyond the
+ * IMU tolerance and the stack tick is never delayed.
+ */
+const bool SCHEDULER_COALESCING = MBED_CONF_APP_SCHEDULER_COALESCING;
+const uint32_t BLINK_MS = 500;
+const uint32_t BLINK_TOLERANCE_MS = 100;
+const uint32_t ENV_POLL_TOLERANCE_MS = 200;
+const uint32_t IMU_POLL_MS = 50;
+const uint32_t IMU_POLL_TOLERANCE_MS = 10;
+const uint32_t LOG_TOLERANCE_MS = 20;
+const uint32_t SLOW_TASK_TOLERANCE_MS = 1000;
+const uint32_t STACK_TICK_MS = 10;
+/* BlueNRG-2: tick the stack on controller interrupts rather than every STACK_TICK_MS */
+const bool STACK_TICK_EVENTS = MBED_CONF_APP_STACK_TICK_EVENTS;
+
+/*
+ * Acquisition is a Ticker interrupt every IMU_POLL_MS that only drains the
+ * IMU FIFO, so BLE processing in the main loop never delays it. The ticker
+ * starts together with the scheduler: its wakeup runs the tasks on the
+ * same grid, "imu report" among them, which processes the blocks handed
+ * over through a lock-free ring. While the ring is full the samples wait
+ * in the FIFO. The main loop takes the IMU over to reconfigure it by
+ * setting _imu_owned, and owns a triggered shock window until the capture
+ * is re-armed; the interrupt leaves the IMU alone meanwhile.
+ */
+struct ImuBlock {
+    int16_t temp;
+    uint16_t sets;
+    int16_t words[IMU_FIFO_BLOCK_SETS * IMU_FIFO_SET_WORDS];
+};
+const unsigned IMU_BLOCKS = 4;
+const uint32_t ACQ_JITTER_LIMIT_US = 300;
+
+/* Stress mode keeps the main loop busy the way a connection setup does */
+const bool ACQ_STRESS = MBED_CONF_APP_ACQUISITION_STRESS;
+const uint32_t ACQ_STRESS_PERIOD_MS = 100;
+const uint32_t ACQ_STRESS_BUSY_US = 20000;
+const uint8_t ACQ_STRESS_BURST = 8;
+const uint32_t ACQ_STRESS_BURST_US = 2000;
+
+/* Accelerometer alone in the FIFO, {XLx, XLy, XLz} at 3.33 kHz */
+const uint16_t IMU_HIGH_ODR_HZ = 3330;
+const uint16_t IMU_FIFO_ACCEL_SET_WORDS = 3;
+/* sets read per SPI burst, on the interrupt stack */
+const uint16_t VIBRATION_BURST_SETS = 16;
+
+/* Summary streams: accel X/Y/Z, gyro X/Y/Z (raw LSB) and temperature (raw LSB) */
+enum {
+    STATS_ACCEL_X, STATS_ACCEL_Y, STATS_ACCEL_Z,
+    STATS_GYRO_X, STATS_GYRO_Y, STATS_GYRO_Z,
+    STATS_TEMP,
+    STATS_STREAMS
+};
+const uint32_t STATS_WINDOW_MS = MBED_CONF_APP_STATS_WINDOW_MS;
+
+const uint32_t VIBRATION_PERIOD_MS = MBED_CONF_APP_VIBRATION_PERIOD_MS;
+const uint8_t VIBRATION_AXIS = MBED_CONF_APP_VIBRATION_AXIS;
+
+/*
+ * Shock capture replaces the continuous streams: the FIFO runs in
+ * stream-to-FIFO mode at the high rate and freezes on the wake-up or
+ * free-fall event, holding the last SHOCK_WINDOW_SAMPLES samples.
+ */
+enum {
+    SHOCK_TRIGGER_WAKE_UP,
+    SHOCK_TRIGGER_FREE_FALL
+};
+const bool SHOCK_CAPTURE = MBED_CONF_APP_SHOCK_CAPTURE;
+const uint8_t SHOCK_TRIGGER = MBED_CONF_APP_SHOCK_TRIGGER;
+const uint8_t SHOCK_THRESHOLD = MBED_CONF_APP_SHOCK_THRESHOLD;
+const uint8_t SHOCK_DURATION = MBED_CONF_APP_SHOCK_DURATION;
+const uint16_t SHOCK_WINDOW_SAMPLES = MBED_CONF_APP_SHOCK_WINDOW_SAMPLES;
+
+class SensorDemo : ble::Gap::EventHandler, GattServer::EventHandler {
 public:
-    SensorDemo(BLE &ble, events::EventQueue &event_queue) :
+    SensorDemo(BLE &ble, events::EventQueue &event_queue, QueueMonitor &queue_monitor, BLEEventPump &event_pump) :
         _ble(ble),
 		_imu_sensor(SPI_MODE, DIO1),
         _event_queue(event_queue),
+        _queue_monitor(queue_monitor),
+        _event_pump(event_pump),
+        _scheduler(event_queue, queue_monitor, SCHEDULER_COALESCING),
+        _imu_owned(false),
+        _acq_started(false),
+        _acq_last_us(0),
+        _acq_jitter_max_us(0),
+        _acq_exec_max_us(0),
+        _acq_deferred(0),
+        _acq_temp(0),
+#ifdef BLUENRG2_DEVICE
+        _stack_ticker(queue_monitor),
+        _stack_ticks(0),
+#endif //BLUENRG2_DEVICE
         _led1(LED1, 1),
         _connected(false),
         _temp(0x0000),
         _b_service(ble, _temp, _accel, _gyro),
+        _fusion(IMU_ODR_HZ, IMU_GYRO_RANGE_DPS),
+        _quat_reports(0),
+        _decimator(IMU_CIC_DECIMATION, IMU_FIR_DECIMATION),
+        _filter_cycles(0),
+        _filter_samples(0),
+        _filter_report(0),
+        _stats_window_samples(STATS_WINDOW_MS * IMU_ODR_HZ / 1000),
+        _stats_window(0),
+        _stats_pending(0),
+        _stats_closed_window(0),
+        _vib_capturing(false),
+        _shock_triggered(false),
+        _shock_words_left(0),
+        _capture_transfer(BULK_CREDITS, BulkTransfer::DEFAULT_SEGMENT_SIZE),
+        _env_report(ENV_DEADBAND, ENV_HEARTBEAT_MS),
+        _imu_report(IMU_ACCEL_DEADBAND, IMU_HEARTBEAT_MS),
+        _quat_report(QUAT_DEADBAND, IMU_HEARTBEAT_MS),
+        _stats_report(IMU_ACCEL_DEADBAND, IMU_HEARTBEAT_MS),
+        _log_transfer(BULK_CREDITS, BulkTransfer::DEFAULT_SEGMENT_SIZE),
+        _bulk_pump_posted(false),
+        _diag_window(0),
+        _diag_pending(0),
+        _sched_wakeups(0),
+        _sched_runs(0),
         _adv_data_builder(_adv_buffer)
 		{
-    		_imu_sensor.begin();
+    		_imu_sensor.settings.gyroRange = IMU_GYRO_RANGE_DPS;
+    		_imu_sensor.settings.gyroSampleRate = IMU_ODR_HZ;
+    		if (SHOCK_CAPTURE) {
+    			configure_imu_shock();
+    		} else {
+    			configure_imu_fusion();
+    		}
+
+    		for (unsigned i = 3; i < 6; i++) {
+    			_imu_report.setDeadband(i, IMU_GYRO_DEADBAND);
+    			_stats_report.setDeadband(STATS_GYRO_X + i - 3, IMU_GYRO_DEADBAND);
+    		}
+    		_stats_report.setDeadband(STATS_TEMP, STATS_TEMP_DEADBAND);
+
+    		memset(_acq_accel, 0, sizeof(_acq_accel));
+    		memset(_acq_gyro, 0, sizeof(_acq_gyro));
+
+    		if (_stats_window_samples > WindowStats::MAX_SAMPLES) {
+    			_stats_window_samples = WindowStats::MAX_SAMPLES;
+    		}
     	}
 
     void start() {
+        /* the names posted outside the scheduler, some of them from interrupts */
+        _queue_monitor.addTask("fft");
+        _queue_monitor.addTask("bulk");
+        _queue_monitor.addTask("flush log");
+        _queue_monitor.addTask("clear log");
+        if (ACQ_STRESS) {
+            _queue_monitor.addTask("stress burst");
+        }
+        _queue_monitor.addTask("acquisition");
+
         _ble.gap().setEventHandler(this);
 
         _ble.init(this, &SensorDemo::on_init_complete);
 
-        _event_queue.call_every(500, this, &SensorDemo::blink);
-        _event_queue.call_every(10000, this, &SensorDemo::update_env_sensor_value);
-        _event_queue.call_every(50, this, &SensorDemo::update_imu_sensor_value);
+        _scheduler.attachTick(IMU_POLL_MS);
+        _scheduler.add("blink", BLINK_MS, BLINK_TOLERANCE_MS, this, &SensorDemo::blink);
+        _scheduler.add("env", ENV_POLL_MS, ENV_POLL_TOLERANCE_MS, this, &SensorDemo::update_env_sensor_value);
+        _scheduler.add("imu report", IMU_POLL_MS, IMU_POLL_TOLERANCE_MS, this, &SensorDemo::publish_imu);
+        CycleCounter::enable();
+        if (VIBRATION_PERIOD_MS && !SHOCK_CAPTURE) {
+            _scheduler.add("vibration", VIBRATION_PERIOD_MS, SLOW_TASK_TOLERANCE_MS, this, &SensorDemo::request_vibration_capture);
+        }
+        if (_log.mount(LOG_FLASH_SIZE, LOG_FLASH_RESERVED)) {
+            _scheduler.add("log sample", LOG_INTERVAL_MS, LOG_TOLERANCE_MS, this, &SensorDemo::log_sample);
+        } else if (LOG_FLASH_SIZE) {
+            printf("Offline log disabled: no free flash region of %lu bytes\r\n", (unsigned long)LOG_FLASH_SIZE);
+        }
+        if (QUEUE_STATS_MS) {
+            _scheduler.add("queue stats", QUEUE_STATS_MS, SLOW_TASK_TOLERANCE_MS, this, &SensorDemo::report_queue_stats);
+        }
 
 #ifdef BLUENRG2_DEVICE
-        _event_queue.call_every(10, &BTLE_StackTick);
+        if (STACK_TICK_EVENTS) {
+            _stack_ticker.start();
+        } else {
+            _scheduler.add("stack tick", STACK_TICK_MS, 0, mbed::callback(&BTLE_StackTick));
+        }
 #endif //BLUENRG2_DEVICE
 
+        if (ACQ_STRESS) {
+            _scheduler.add("stress", ACQ_STRESS_PERIOD_MS, 0, this, &SensorDemo::stress_main_loop);
+        }
+
+#if defined(MBED_CPU_STATS_ENABLED)
+        mbed_stats_cpu_get(&_cpu_stats);
+#endif
+        _scheduler.start();
+        /* from now on the ticks fall on the scheduler deadlines */
+        _acq_ticker.attach_us(mbed::callback(this, &SensorDemo::acquire), IMU_POLL_MS * 1000);
+
         _event_queue.dispatch_forever();
     }
 
@@ -61,7 +304,16 @@ private:
             return;
         }
 
+        _ble.gattServer().onDataWritten(this, &SensorDemo::on_data_written);
+        _ble.gattServer().onDataSent(this, &SensorDemo::on_data_sent);
+        _ble.gattServer().onUpdatesEnabled(makeFunctionPointer(this, &SensorDemo::on_updates_enabled));
+        _ble.gattServer().setEventHandler(this);
+
         print_mac_address();
+        printf(
+            "Sensor service: %u bytes of RAM, registered in %lu us\r\n",
+            (unsigned)sizeof(BluenrgSensorService), (unsigned long)_b_service.setupTime()
+        );
         start_advertising();
     }
 
@@ -105,6 +357,7 @@ private:
         /* Start advertising */
 
         error = _ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        kick_stack();
 
         if (error) {
             printf("_ble.gap().startAdvertising() failed\r\n");
@@ -114,45 +367,729 @@ private:
 
     void update_env_sensor_value() {
         if (_connected) {
-        	_temp = (int16_t)(_imu_sensor.readTempC() * 10);
-        	_b_service.updateTemperature(_temp);
+        	/* 16 LSB per degree, 0 at 25 degrees */
+        	_temp = (int16_t)(_acq_temp * 10 / 16 + 250);
+        	if (_env_report.update(&_temp, 1, _event_queue.tick())) {
+        		_b_service.updateTemperature((uint16_t)(_event_queue.tick() >> 3), _temp);
+        		kick_stack();
+        	}
         }
     }
 
-    void update_imu_sensor_value() {
+    /**
+     * Acquisition tick: drain the IMU and wake the main loop for the tasks
+     * of this tick. Interrupt level, nothing here may block or print.
+     */
+    void acquire() {
+        uint32_t start = us_ticker_read();
+        if (_acq_started) {
+            int32_t jitter = (int32_t)(start - _acq_last_us - IMU_POLL_MS * 1000);
+            uint32_t deviation = (jitter < 0) ? -jitter : jitter;
+            if (deviation > _acq_jitter_max_us) {
+                _acq_jitter_max_us = deviation;
+            }
+        }
+        _acq_started = true;
+        _acq_last_us = start;
+
+        if (!_imu_owned) {
+            if (SHOCK_CAPTURE) {
+                poll_shock_trigger();
+            } else if (_vib_capturing) {
+                drain_vibration_fifo();
+            } else {
+                /* fusion has to see every sample, drain even when nobody listens */
+                drain_imu_fifo();
+            }
+        }
+
+        _queue_monitor.call("acquisition", mbed::callback(&_scheduler, &PeriodicScheduler::tick));
+
+        uint32_t exec = us_ticker_read() - start;
+        if (exec > _acq_exec_max_us) {
+            _acq_exec_max_us = exec;
+        }
+    }
+
+    /** Main loop side of the acquisition: process the drained blocks, notify the result. */
+    void publish_imu() {
+        if (_connected) {
+            publish_next_diag_record();
+        }
+
+        if (SHOCK_CAPTURE) {
+            if (_shock_triggered && !_capture_transfer.active()) {
+                start_shock_transfer();
+            }
+            if (_connected) {
+                pump_bulk_transfers();
+            }
+            return;
+        }
+
+        /* nothing new while a vibration block is captured */
+        if (!process_imu_blocks()) {
+            return;
+        }
+        memcpy(_accel, _acq_accel, sizeof(_accel));
+        memcpy(_gyro, _acq_gyro, sizeof(_gyro));
+
+#if MBED_CONF_APP_FILTER_BENCHMARK
+        if (_filter_report) {
+            printf("Filter: %lu cycles/sample\r\n", (unsigned long)_filter_report);
+            _filter_report = 0;
+        }
+#endif
+
         if (_connected) {
-        	_accel[0] = (_imu_sensor.readRawAccelY());
-        	_accel[1] = (_imu_sensor.readRawAccelX());
-        	_accel[2] = (_imu_sensor.readRawAccelZ());
-        	_b_service.updateAccel(_accel);
-        	_gyro[0] = _imu_sensor.readRawGyroY();
-        	_gyro[1] = _imu_sensor.readRawGyroX();
-        	_gyro[2] = _imu_sensor.readRawGyroZ();
-        	_b_service.updateGyro(_gyro);
+        	int16_t imu[6] = { _accel[0], _accel[1], _accel[2], _gyro[0], _gyro[1], _gyro[2] };
+        	if (_imu_report.update(imu, 6, _event_queue.tick())) {
+        		_b_service.updateImu((uint16_t)(_event_queue.tick() >> 3), _accel, _gyro);
+        	}
+
+        	if (++_quat_reports >= QUAT_DECIMATION) {
+        		int16_t quat[3];
+        		_fusion.getBlueSTVector(quat);
+        		_quat_reports = 0;
+        		if (_quat_report.update(quat, 3, _event_queue.tick())) {
+        			_b_service.updateQuaternion((uint16_t)(_event_queue.tick() >> 3), quat);
+        		}
+        	}
+
+        	publish_next_stats_record();
+        	kick_stack();
+        }
+    }
+
+    /**
+     * Read the complete data sets queued in the IMU FIFO, up to a block, in
+     * one burst straight into the ring. By whoever owns the IMU.
+     */
+    void drain_imu_fifo() {
+        ImuBlock *block = _imu_blocks.claim();
+        if (!block) {
+            _acq_deferred++;
+            return;
+        }
+
+        uint16_t words;
+        uint16_t pattern;
+        _imu_sensor.fifoGetLevel(&words, &pattern);
+        _acq_temp = _imu_sensor.readRawTemp();
+
+        /* resynchronise on a gyro X word */
+        if (pattern != 0) {
+            uint16_t skip = IMU_FIFO_SET_WORDS - pattern;
+            if (skip > words) {
+                return;
+            }
+            _imu_sensor.fifoReadBurst(block->words, skip);
+            words -= skip;
+        }
+
+        uint16_t sets = words / IMU_FIFO_SET_WORDS;
+        if (sets > IMU_FIFO_BLOCK_SETS) {
+            sets = IMU_FIFO_BLOCK_SETS;
+        }
+        if (sets) {
+            _imu_sensor.fifoReadBurst(block->words, sets * IMU_FIFO_SET_WORDS);
+        }
+        block->sets = sets;
+        block->temp = _acq_temp;
+        _imu_blocks.commit();
+    }
+
+    /** @return false when nothing was drained since the last call. */
+    bool process_imu_blocks() {
+        bool fresh = false;
+        const ImuBlock *block;
+        while ((block = _imu_blocks.peek()) != NULL) {
+            for (uint16_t i = 0; i < block->sets; i++) {
+                const int16_t *set = &block->words[i * IMU_FIFO_SET_WORDS];
+                process_imu_sample(set, set + 3);
+            }
+            _stats[STATS_TEMP].add(block->temp);
+            _imu_blocks.release();
+            fresh = true;
+        }
+        return fresh;
+    }
+
+    void process_imu_sample(const int16_t *gyro, const int16_t *accel) {
+        _fusion.update(gyro, accel);
+
+        for (int i = 0; i < 3; i++) {
+            _stats[STATS_ACCEL_X + i].add(accel[i]);
+            _stats[STATS_GYRO_X + i].add(gyro[i]);
+        }
+        if (_stats[STATS_ACCEL_X].count() >= _stats_window_samples) {
+            close_stats_window();
+        }
+
+        /* band limit before the characteristic picks one value per tick */
+        int16_t in[6] = { accel[0], accel[1], accel[2], gyro[0], gyro[1], gyro[2] };
+        int16_t out[6];
+
+#if MBED_CONF_APP_FILTER_BENCHMARK
+        uint32_t start = CycleCounter::read();
+        bool ready = _decimator.push(in, out);
+        _filter_cycles += CycleCounter::read() - start;
+
+        if (++_filter_samples == IMU_ODR_HZ) {
+            _filter_report = _filter_cycles / _filter_samples;
+            _filter_cycles = 0;
+            _filter_samples = 0;
         }
+#else
+        bool ready = _decimator.push(in, out);
+#endif
+
+        if (ready) {
+            _acq_accel[0] = out[1];
+            _acq_accel[1] = out[0];
+            _acq_accel[2] = out[2];
+            _acq_gyro[0] = out[4];
+            _acq_gyro[1] = out[3];
+            _acq_gyro[2] = out[5];
+        }
+    }
+
+    /**
+     * Freeze the current window, its records go out one per IMU tick. A
+     * window closing while the main loop still sends the previous one, or
+     * while no central is connected, is skipped; the window counter shows
+     * the gap.
+     */
+    void close_stats_window() {
+        if (!_stats_pending && _connected) {
+            for (int i = 0; i < STATS_STREAMS; i++) {
+                _stats_closed[i] = _stats[i];
+            }
+            _stats_closed_window = _stats_window;
+            _stats_pending = STATS_STREAMS;
+        }
+
+        for (int i = 0; i < STATS_STREAMS; i++) {
+            _stats[i].reset();
+        }
+        _stats_window++;
+    }
+
+    void publish_next_stats_record() {
+        if (!_stats_pending) {
+            return;
+        }
+
+        /* a window whose means stayed within their deadband is dropped whole */
+        if (_stats_pending == STATS_STREAMS) {
+            int16_t means[STATS_STREAMS];
+            for (int i = 0; i < STATS_STREAMS; i++) {
+                means[i] = _stats_closed[i].mean();
+            }
+            if (!_stats_report.update(means, STATS_STREAMS, _event_queue.tick())) {
+                _stats_pending = 0;
+                return;
+            }
+        }
+
+        uint8_t stream = STATS_STREAMS - _stats_pending;
+        _b_service.updateStats(
+            (uint16_t)(_event_queue.tick() >> 3),
+            stream,
+            _stats_closed_window,
+            _stats_closed[stream]
+        );
+        _stats_pending--;
+    }
+
+    /** Gyro and accelerometer both in the FIFO at the fusion rate. */
+    void configure_imu_fusion() {
+        _imu_sensor.fifoEnd();
+        _imu_sensor.settings.accelSampleRate = IMU_ODR_HZ;
+        _imu_sensor.settings.gyroFifoEnabled = 1;
+        _imu_sensor.settings.accelFifoEnabled = 1;
+        _imu_sensor.settings.fifoSampleRate = 800; //FIFO ODR code for 833Hz
+        _imu_sensor.begin();
+        _imu_sensor.fifoBegin();
+    }
+
+    /** Accelerometer alone in the FIFO at the vibration rate. */
+    void configure_imu_vibration() {
+        _imu_sensor.fifoEnd();
+        _imu_sensor.settings.accelSampleRate = IMU_HIGH_ODR_HZ;
+        _imu_sensor.settings.gyroFifoEnabled = 0;
+        _imu_sensor.settings.accelFifoEnabled = 1;
+        _imu_sensor.settings.fifoSampleRate = 3300; //FIFO ODR code for 3.33kHz
+        _imu_sensor.begin();
+        _imu_sensor.fifoBegin();
+    }
+
+    /**
+     * Switch the IMU to the vibration rate for one FFT block (about 77 ms),
+     * fusion and statistics pause meanwhile. The acquisition drains the
+     * block, the IMU is reconfigured here in the main loop.
+     */
+    void request_vibration_capture() {
+        if (_vib_capturing) {
+            return;
+        }
+
+        _imu_owned = true;
+        drain_imu_fifo();
+        _vibration.reset();
+        configure_imu_vibration();
+        _vib_capturing = true;
+        _imu_owned = false;
+    }
+
+    /** Acquisition context, hands the IMU to the main loop once the block is full. */
+    void drain_vibration_fifo() {
+        int16_t burst[VIBRATION_BURST_SETS * IMU_FIFO_ACCEL_SET_WORDS];
+        uint16_t words;
+        uint16_t pattern;
+        _imu_sensor.fifoGetLevel(&words, &pattern);
+
+        /* resynchronise on an accelerometer X word */
+        if (pattern != 0) {
+            uint16_t skip = IMU_FIFO_ACCEL_SET_WORDS - pattern;
+            if (skip > words) {
+                return;
+            }
+            _imu_sensor.fifoReadBurst(burst, skip);
+            words -= skip;
+        }
+
+        while (words >= IMU_FIFO_ACCEL_SET_WORDS && !_vibration.full()) {
+            uint16_t sets = words / IMU_FIFO_ACCEL_SET_WORDS;
+            if (sets > VIBRATION_BURST_SETS) {
+                sets = VIBRATION_BURST_SETS;
+            }
+
+            _imu_sensor.fifoReadBurst(burst, sets * IMU_FIFO_ACCEL_SET_WORDS);
+            for (uint16_t i = 0; i < sets; i++) {
+                _vibration.add(burst[i * IMU_FIFO_ACCEL_SET_WORDS + VIBRATION_AXIS]);
+            }
+            words -= sets * IMU_FIFO_ACCEL_SET_WORDS;
+        }
+
+        if (_vibration.full()) {
+            _imu_owned = true;
+            _queue_monitor.call("fft", this, &SensorDemo::analyse_vibration);
+        }
+    }
+
+    /** Give the IMU back to fusion, then analyse the block. */
+    void analyse_vibration() {
+        configure_imu_fusion();
+        _vib_capturing = false;
+        _imu_owned = false;
+
+        VibrationSpectrum spectrum;
+
+        uint32_t start = CycleCounter::read();
+        _vibration.analyse(IMU_HIGH_ODR_HZ, spectrum);
+        uint32_t cycles = CycleCounter::read() - start;
+
+#if MBED_CONF_APP_FFT_BENCHMARK
+        printf("FFT %u points: %lu cycles\r\n", VibrationAnalyzer::FFT_SIZE, (unsigned long)cycles);
+#else
+        (void)cycles;
+#endif
+
+        if (_connected) {
+            _b_service.updateSpectrum((uint16_t)(_event_queue.tick() >> 3), IMU_HIGH_ODR_HZ, VIBRATION_AXIS, spectrum);
+            kick_stack();
+        }
+    }
+
+    /** Accelerometer alone in a stream-to-FIFO window, frozen by the trigger event. */
+    void configure_imu_shock() {
+        _imu_sensor.fifoEnd();
+        _imu_sensor.settings.accelSampleRate = IMU_HIGH_ODR_HZ;
+        _imu_sensor.settings.gyroFifoEnabled = 0;
+        _imu_sensor.settings.accelFifoEnabled = 1;
+        _imu_sensor.settings.fifoSampleRate = 3300; //FIFO ODR code for 3.33kHz
+        _imu_sensor.settings.fifoThreshold = SHOCK_WINDOW_SAMPLES * IMU_FIFO_ACCEL_SET_WORDS;
+        _imu_sensor.settings.fifoStopOnThreshold = 1;
+        _imu_sensor.settings.fifoModeWord = LSM6DS3_ACC_GYRO_FIFO_MODE_STF;
+        _imu_sensor.begin();
+
+        if (SHOCK_TRIGGER == SHOCK_TRIGGER_FREE_FALL) {
+            _imu_sensor.freeFallBegin(SHOCK_THRESHOLD, SHOCK_DURATION);
+        } else {
+            _imu_sensor.wakeUpBegin(SHOCK_THRESHOLD, SHOCK_DURATION);
+        }
+        _imu_sensor.fifoBegin();
+    }
+
+    /**
+     * Acquisition context, the idle cost is one register read per tick.
+     * Once triggered, the frozen window stays in the sensor and belongs to
+     * the main loop, which reads it out straight into the capture
+     * characteristic once a central is connected.
+     */
+    void poll_shock_trigger() {
+        if (_shock_triggered) {
+            return;
+        }
+
+        uint8_t source;
+        _imu_sensor.readEventSource(&source);
+        if (!(source & (LSM6DS3_ACC_GYRO_WU_EV_STATUS_DETECTED | LSM6DS3_ACC_GYRO_FF_EV_STATUS_DETECTED))) {
+            _acq_temp = _imu_sensor.readRawTemp();
+            return;
+        }
+
+        uint16_t words;
+        uint16_t pattern;
+        _imu_sensor.fifoGetLevel(&words, &pattern);
+
+        /* resynchronise on an accelerometer X word */
+        if (pattern != 0) {
+            uint16_t skip = IMU_FIFO_ACCEL_SET_WORDS - pattern;
+            if (skip > words) {
+                skip = words;
+            }
+            _imu_sensor.fifoReadBurst(_shock_samples, skip);
+            words -= skip;
+        }
+
+        _shock_words_left = words - words % IMU_FIFO_ACCEL_SET_WORDS;
+        __DMB();
+        _shock_triggered = true;
+    }
+
+    void start_shock_transfer() {
+        _capture_transfer.start(
+            mbed::callback(this, &SensorDemo::read_shock_window),
+            mbed::callback(&_b_service, &BluenrgSensorService::updateCapture)
+        );
+    }
+
+    /** BulkTransfer source: whole samples straight out of the frozen FIFO. */
+    unsigned read_shock_window(uint8_t *out, unsigned max, bool *last) {
+        uint16_t words = max / (2 * IMU_FIFO_ACCEL_SET_WORDS) * IMU_FIFO_ACCEL_SET_WORDS;
+        if (words > _shock_words_left) {
+            words = _shock_words_left;
+        }
+
+        _imu_sensor.fifoReadBurst(_shock_samples, words);
+        for (uint16_t i = 0; i < words; i++) {
+            out[2 * i] = (uint8_t)_shock_samples[i];
+            out[2 * i + 1] = (uint8_t)(_shock_samples[i] >> 8);
+        }
+
+        _shock_words_left -= words;
+        *last = !_shock_words_left;
+        return 2 * words;
+    }
+
+    /** Flush the FIFO through bypass mode and give the IMU back to the acquisition. */
+    void rearm_shock_capture() {
+        uint8_t source;
+        _imu_sensor.fifoSetMode(LSM6DS3_ACC_GYRO_FIFO_MODE_BYPASS);
+        _imu_sensor.readEventSource(&source);
+        _imu_sensor.fifoSetMode(LSM6DS3_ACC_GYRO_FIFO_MODE_STF);
+        __DMB();
+        _shock_triggered = false;
+    }
+
+    void log_sample() {
+        if (_connected) {
+            return;
+        }
+
+        int16_t values[LOG_CHANNELS] = {
+            _accel[0], _accel[1], _accel[2], _gyro[0], _gyro[1], _gyro[2], _acq_temp
+        };
+        if (SHOCK_CAPTURE) {
+            /* _accel/_gyro are not updated while the FIFO holds captures */
+            values[0] = _acq_temp;
+        }
+
+        if (!_log_block.count()) {
+            _log_block.start(_event_queue.tick(), LOG_INTERVAL_MS, log_channels());
+        }
+        if (!_log_block.add(values)) {
+            flush_log();
+            _log_block.start(_event_queue.tick(), LOG_INTERVAL_MS, log_channels());
+            _log_block.add(values);
+        }
+    }
+
+    /** Append the open block so it is part of the next download. */
+    void flush_log() {
+        if (_log_block.count()) {
+            _log.append(_log_block);
+            _log_block.start(0, LOG_INTERVAL_MS, log_channels());
+        }
+    }
+
+    /** Channels of a log block: all of them, or the temperature alone in shock mode. */
+    static uint8_t log_channels() {
+        return SHOCK_CAPTURE ? 1 : LOG_CHANNELS;
+    }
+
+    void on_data_written(const GattWriteCallbackParams *params) {
+        if (params->handle != _b_service.getLogHandle() || params->len < 1) {
+            return;
+        }
+
+        switch (params->data[0]) {
+            case LOG_COMMAND_DOWNLOAD:
+            case LOG_COMMAND_DOWNLOAD_PLAIN:
+                _log.rewind();
+                _log_transfer.start(
+                    mbed::callback(this, &SensorDemo::read_log),
+                    mbed::callback(&_b_service, &BluenrgSensorService::updateLog),
+                    params->data[0] == LOG_COMMAND_DOWNLOAD
+                );
+                pump_bulk_transfers();
+                break;
+            case LOG_COMMAND_CLEAR:
+                _log_transfer.cancel();
+                _log.clear();
+                _queue_monitor.call("clear log", this, &SensorDemo::clear_log_step);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /** One sector per event, BLE processing goes on between two erases. */
+    void clear_log_step() {
+        if (_log.clear_step()) {
+            _queue_monitor.call("clear log", this, &SensorDemo::clear_log_step);
+        }
+    }
+
+    /** BulkTransfer source: the log records, oldest first. */
+    unsigned read_log(uint8_t *out, unsigned max, bool *last) {
+        unsigned length = _log.read(out, max);
+        *last = length < max;
+        return length;
+    }
+
+    /**
+     * The count covers the notifications of every characteristic, each
+     * transfer only takes back the segments it has in flight. A single pump
+     * is posted however many reports arrive before it runs.
+     */
+    void on_data_sent(unsigned count) {
+        count -= _log_transfer.onDataSent(count);
+        _capture_transfer.onDataSent(count);
+        if ((_capture_transfer.active() || _log_transfer.active()) && !_bulk_pump_posted) {
+            _bulk_pump_posted = true;
+            _queue_monitor.call("bulk", this, &SensorDemo::pump_bulk_transfers);
+        }
+    }
+
+    /** A transfer waits for its central to subscribe before it sends anything. */
+    void on_updates_enabled(GattAttribute::Handle_t) {
+        if (_capture_transfer.active() || _log_transfer.active()) {
+            pump_bulk_transfers();
+        }
+    }
+
+    /**
+     * Fill the stack notification buffers, called again as soon as some of
+     * them have been sent. Completed transfers report their throughput.
+     */
+    void pump_bulk_transfers() {
+        _bulk_pump_posted = false;
+
+        if (_log_transfer.active()) {
+            _log_transfer.pump(_event_queue.tick());
+            kick_stack();
+            if (!_log_transfer.active()) {
+                report_transfer("Log download", _log_transfer);
+            }
+        }
+
+        if (_capture_transfer.active()) {
+            _capture_transfer.pump(_event_queue.tick());
+            kick_stack();
+            if (!_capture_transfer.active()) {
+                report_transfer("Shock capture", _capture_transfer);
+                rearm_shock_capture();
+            }
+        }
+    }
+
+    void report_transfer(const char *name, const BulkTransfer &transfer) {
+        uint32_t elapsed_ms = transfer.elapsedMs();
+        printf("%s: %lu bytes in %lu ms, %lu bytes/s with %u byte segments\r\n", name,
+               (unsigned long)transfer.bytes(), (unsigned long)elapsed_ms,
+               (unsigned long)(elapsed_ms ? (uint64_t)transfer.bytes() * 1000 / elapsed_ms : 0),
+               transfer.transferSegmentSize());
+    }
+
+    /** Close the event queue window, its records go out one per IMU tick. */
+    void report_queue_stats() {
+        _queue_monitor.closeWindow(_diag_closed);
+        _queue_monitor.print(_diag_closed);
+        _event_pump.print();
+        _diag_window++;
+
+        uint32_t jitter;
+        uint32_t exec;
+        {
+            CriticalSectionLock lock;
+            jitter = _acq_jitter_max_us;
+            exec = _acq_exec_max_us;
+            _acq_jitter_max_us = 0;
+            _acq_exec_max_us = 0;
+        }
+        printf("Acquisition: jitter %lu us, drain max %lu us, %lu blocks left in the FIFO\r\n",
+               (unsigned long)jitter, (unsigned long)exec, (unsigned long)_acq_deferred);
+        if (ACQ_STRESS) {
+            printf("Stress: acquisition jitter %lu us, limit %lu us: %s\r\n",
+                   (unsigned long)jitter, (unsigned long)ACQ_JITTER_LIMIT_US,
+                   (jitter <= ACQ_JITTER_LIMIT_US) ? "PASS" : "FAIL");
+        }
+        _diag_pending = _queue_monitor.tasks() + 1;
+
+        /* hundredths of a wakeup per second */
+        uint32_t wakeups = (_scheduler.wakeups() - _sched_wakeups) * 100000ULL / QUEUE_STATS_MS;
+        uint32_t runs = (_scheduler.runs() - _sched_runs) * 100000ULL / QUEUE_STATS_MS;
+        _sched_wakeups = _scheduler.wakeups();
+        _sched_runs = _scheduler.runs();
+        printf("Scheduler: %lu.%02lu wakeups/s for %lu.%02lu task runs/s\r\n",
+               (unsigned long)(wakeups / 100), (unsigned long)(wakeups % 100),
+               (unsigned long)(runs / 100), (unsigned long)(runs % 100));
+
+#ifdef BLUENRG2_DEVICE
+        if (STACK_TICK_EVENTS) {
+            uint32_t ticks = (_stack_ticker.ticks() - _stack_ticks) * 100000ULL / QUEUE_STATS_MS;
+            _stack_ticks = _stack_ticker.ticks();
+            printf("Stack: %lu.%02lu ticks/s, %lu controller interrupts, %lu fallback polls\r\n",
+                   (unsigned long)(ticks / 100), (unsigned long)(ticks % 100),
+                   (unsigned long)_stack_ticker.irqs(), (unsigned long)_stack_ticker.polls());
+        }
+#endif //BLUENRG2_DEVICE
+
+#if defined(MBED_CPU_STATS_ENABLED)
+        mbed_stats_cpu_t cpu;
+        mbed_stats_cpu_get(&cpu);
+        us_timestamp_t uptime = cpu.uptime - _cpu_stats.uptime;
+        if (uptime) {
+            printf("CPU: sleep %lu%%, deep sleep %lu%%\r\n",
+                   (unsigned long)((cpu.sleep_time - _cpu_stats.sleep_time) * 100 / uptime),
+                   (unsigned long)((cpu.deep_sleep_time - _cpu_stats.deep_sleep_time) * 100 / uptime));
+        }
+        _cpu_stats = cpu;
+#endif
+    }
+
+    void publish_next_diag_record() {
+        if (!_diag_pending) {
+            return;
+        }
+
+        uint16_t timestamp = (uint16_t)(_event_queue.tick() >> 3);
+        unsigned task = _queue_monitor.tasks() + 1 - _diag_pending;
+        if (task == 0) {
+            _b_service.updateQueueDiagnostics(timestamp, _diag_window, _queue_monitor);
+        } else {
+            _b_service.updateTaskDiagnostics(timestamp, _diag_window, task - 1, _diag_closed[task - 1]);
+        }
+        _diag_pending--;
+        kick_stack();
+    }
+
+    /** Stress mode: a long busy task followed by a burst of short events. */
+    void stress_main_loop() {
+        wait_us(ACQ_STRESS_BUSY_US);
+        for (uint8_t i = 0; i < ACQ_STRESS_BURST; i++) {
+            _queue_monitor.call("stress burst", this, &SensorDemo::stress_burst);
+        }
+    }
+
+    void stress_burst() {
+        wait_us(ACQ_STRESS_BURST_US);
     }
 
     void blink(void) {
         _led1 = !_led1;
     }
 
+    /** Let the stack process a call right away rather than at the next interrupt. */
+    void kick_stack() {
+#ifdef BLUENRG2_DEVICE
+        if (STACK_TICK_EVENTS) {
+            _stack_ticker.kick();
+        }
+#endif //BLUENRG2_DEVICE
+    }
+
 private:
     /* Event handler */
 
     void onDisconnectionComplete(const ble::DisconnectionCompleteEvent&) {
         _ble.gap().startAdvertising(ble::LEGACY_ADVERTISING_HANDLE);
+        kick_stack();
         _connected = false;
+        /* the next central starts with a fresh window */
+        _stats_pending = 0;
+        _log_transfer.cancel();
+        set_bulk_segment_size(BulkTransfer::DEFAULT_SEGMENT_SIZE);
+
+        printf("Env: %lu sent, %lu suppressed\r\n",
+               (unsigned long)_env_report.sent(), (unsigned long)_env_report.suppressed());
+        printf("IMU: %lu sent, %lu suppressed\r\n",
+               (unsigned long)_imu_report.sent(), (unsigned long)_imu_report.suppressed());
+        printf("Quaternion: %lu sent, %lu suppressed\r\n",
+               (unsigned long)_quat_report.sent(), (unsigned long)_quat_report.suppressed());
+        printf("Stats: %lu windows sent, %lu suppressed\r\n",
+               (unsigned long)_stats_report.sent(), (unsigned long)_stats_report.suppressed());
     }
 
     virtual void onConnectionComplete(const ble::ConnectionCompleteEvent &event) {
         if (event.getStatus() == BLE_ERROR_NONE) {
             _connected = true;
+            _env_report.force();
+            _imu_report.force();
+            _quat_report.force();
+            _stats_report.force();
+            _queue_monitor.call("flush log", this, &SensorDemo::flush_log);
+            _capture_transfer.resetCredits();
+            _log_transfer.resetCredits();
         }
     }
 
+    /** Segments fill the notification payload of the negotiated MTU. */
+    virtual void onAttMtuChange(ble::connection_handle_t, uint16_t att_mtu) {
+        set_bulk_segment_size(att_mtu - 3);
+        printf("ATT MTU %u: bulk segments of %u bytes\r\n", att_mtu, _log_transfer.segmentSize());
+    }
+
+    void set_bulk_segment_size(unsigned segment_size) {
+        _capture_transfer.setSegmentSize(segment_size);
+        _log_transfer.setSegmentSize(segment_size);
+    }
+
 private:
     BLE &_ble;
     events::EventQueue &_event_queue;
+    QueueMonitor &_queue_monitor;
+    BLEEventPump &_event_pump;
+    PeriodicScheduler _scheduler;
+#ifdef BLUENRG2_DEVICE
+    StackTicker _stack_ticker;
+    uint32_t _stack_ticks;
+#endif //BLUENRG2_DEVICE
+
+    Ticker _acq_ticker;
+    SpscRing<ImuBlock, IMU_BLOCKS> _imu_blocks;
+    volatile bool _imu_owned;
+    bool _acq_started;
+    uint32_t _acq_last_us;
+    volatile uint32_t _acq_jitter_max_us;
+    volatile uint32_t _acq_exec_max_us;
+    volatile uint32_t _acq_deferred;
+    int16_t _acq_accel[3];
+    int16_t _acq_gyro[3];
+    volatile int16_t _acq_temp;
     DigitalOut _led1;
     bool _connected;
 
@@ -161,6 +1098,46 @@ private:
     int16_t _gyro[3];  //_gyro[] = {valY, valX, valZ}
     BluenrgSensorService _b_service;
     LSM6DS3 _imu_sensor;
+    ImuFusion _fusion;
+    uint8_t _quat_reports;
+    DecimationFilter<6> _decimator;
+    uint32_t _filter_cycles;
+    uint32_t _filter_samples;
+    volatile uint32_t _filter_report;
+
+    WindowStats _stats[STATS_STREAMS];
+    WindowStats _stats_closed[STATS_STREAMS];
+    uint32_t _stats_window_samples;
+    uint8_t _stats_window;
+    uint8_t _stats_pending;
+    uint8_t _stats_closed_window;
+
+    VibrationAnalyzer _vibration;
+    volatile bool _vib_capturing;
+
+    volatile bool _shock_triggered;
+    uint16_t _shock_words_left;
+    int16_t _shock_samples[BulkTransfer::MAX_SEGMENT_SIZE / 2];
+    BulkTransfer _capture_transfer;
+
+    DeadbandFilter _env_report;
+    DeadbandFilter _imu_report;
+    DeadbandFilter _quat_report;
+    DeadbandFilter _stats_report;
+
+    FlashLog _log;
+    SampleBlockEncoder _log_block;
+    BulkTransfer _log_transfer;
+    bool _bulk_pump_posted;
+
+    QueueMonitor::TaskStats _diag_closed[QueueMonitor::MAX_TASKS];
+    uint8_t _diag_window;
+    uint8_t _diag_pending;
+    uint32_t _sched_wakeups;
+    uint32_t _sched_runs;
+#if defined(MBED_CPU_STATS_ENABLED)
+    mbed_stats_cpu_t _cpu_stats;
+#endif
 
     uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
     ble::AdvertisingDataBuilder _adv_data_builder;
@@ -0,0 +1,70 @@
+/*
+ * SpscRing.h
+ *
+ * Lock-free single producer, single consumer ring buffer.
+ */
+
+#ifndef SOURCE_SPSCRING_H_
+#define SOURCE_SPSCRING_H_
+
+#include <mbed.h>
+
+/**
+ * Hands items from one execution context to another, typically from an
+ * interrupt to the main loop, without a critical section: the producer
+ * only writes _head, the consumer only writes _tail, and each publishes
+ * its index after it is done with the item.
+ *
+ * Items are filled and read in place, the ring can hold large blocks
+ * without a copy on either side.
+ *
+ * SIZE must be a power of two, the ring holds SIZE - 1 items.
+ */
+template <typename T, unsigned SIZE>
+class SpscRing {
+public:
+    SpscRing() : _head(0), _tail(0) { }
+
+    /** Producer side: the free item to fill, NULL when full. */
+    T *claim()
+    {
+        unsigned head = _head;
+        if (((head + 1) & (SIZE - 1)) == _tail) {
+            return NULL;
+        }
+        return &_items[head];
+    }
+
+    /** Producer side: publish the item returned by claim(). */
+    void commit()
+    {
+        __DMB();
+        _head = (_head + 1) & (SIZE - 1);
+    }
+
+    /** Consumer side: the oldest item, NULL when empty. */
+    T *peek()
+    {
+        unsigned tail = _tail;
+        if (tail == _head) {
+            return NULL;
+        }
+
+        __DMB();
+        return &_items[tail];
+    }
+
+    /** Consumer side: give the item returned by peek() back. */
+    void release()
+    {
+        __DMB();
+        _tail = (_tail + 1) & (SIZE - 1);
+    }
+
+private:
+    T _items[SIZE];
+    volatile unsigned _head;
+    volatile unsigned _tail;
+};
+
+#endif /* SOURCE_SPSCRING_H_ */
@@ -0,0 +1,134 @@
+/*
+ * StackTicker.h
+ *
+ * Event driven BTLE_StackTick for the BlueNRG-2 native stack.
+ */
+
+#ifndef SOURCE_STACKTICKER_H_
+#define SOURCE_STACKTICKER_H_
+
+#ifdef BLUENRG2_DEVICE
+
+#include <mbed.h>
+#include "bluenrg1_stack.h"
+#include "QueueMonitor.h"
+
+/**
+ * Ticks the stack when it has something to do instead of every 10 ms.
+ *
+ * The BLE controller interrupt (radio events and the stack virtual timers)
+ * posts one tick to the main queue, and so does every call into the stack
+ * through kick(). After every tick the stack is asked whether it could
+ * sleep; while it reports pending work a fallback poll follows POLL_MS
+ * later, otherwise nothing runs until the next interrupt or call.
+ *
+ * The Cortex-M0 of the BlueNRG-2 has no VTOR, NVIC_SetVector would need a
+ * vector table in RAM that the port does not provide. The interrupt reaches
+ * onControllerInterrupt() through RAL_Isr(), which the handler of the port
+ * calls, wrapped at link time (stack_tick_profile.json, see main.cpp).
+ */
+class StackTicker {
+public:
+    static const int POLL_MS = 10;
+
+    StackTicker(QueueMonitor &monitor) :
+        _monitor(monitor),
+        _tick_posted(false),
+        _poll_posted(false),
+        _irqs(0),
+        _ticks(0),
+        _polls(0)
+    {
+        _monitor.addTask("stack tick");
+        _monitor.addTask("stack poll");
+    }
+
+    void start()
+    {
+        instance() = this;
+        kick();
+    }
+
+    /** Tick as soon as possible, e.g. after a call into the stack. */
+    void kick()
+    {
+        if (_tick_posted) {
+            return;
+        }
+        _tick_posted = true;
+        if (!_monitor.call("stack tick", this, &StackTicker::tick)) {
+            _tick_posted = false;
+        }
+    }
+
+    /** Called from the controller interrupt, after the stack handled it. */
+    static void onControllerInterrupt()
+    {
+        StackTicker *ticker = instance();
+        if (ticker) {
+            ticker->_irqs++;
+            ticker->kick();
+        }
+    }
+
+    /** Controller interrupts seen. */
+    uint32_t irqs() const
+    {
+        return _irqs;
+    }
+
+    /** Stack ticks run, fallback polls included. */
+    uint32_t ticks() const
+    {
+        return _ticks;
+    }
+
+    /** Ticks that came from the fallback poll. */
+    uint32_t polls() const
+    {
+        return _polls;
+    }
+
+private:
+    /* BlueNRG_Stack_Perform_Deep_Sleep_Check() result while the stack is busy */
+    static const uint8_t STACK_RUNNING = 0;
+
+    void tick()
+    {
+        _tick_posted = false;
+        BTLE_StackTick();
+        _ticks++;
+
+        if (!_poll_posted && BlueNRG_Stack_Perform_Deep_Sleep_Check() == STACK_RUNNING) {
+            _poll_posted = true;
+            if (!_monitor.call_in("stack poll", POLL_MS, this, &StackTicker::poll)) {
+                _poll_posted = false;
+            }
+        }
+    }
+
+    void poll()
+    {
+        _poll_posted = false;
+        _polls++;
+        tick();
+    }
+
+    /* the interrupt hook is a plain function, there is one ticker */
+    static StackTicker *&instance()
+    {
+        static StackTicker *ticker = NULL;
+        return ticker;
+    }
+
+    QueueMonitor &_monitor;
+    volatile bool _tick_posted;
+    bool _poll_posted;
+    volatile uint32_t _irqs;
+    uint32_t _ticks;
+    uint32_t _polls;
+};
+
+#endif // BLUENRG2_DEVICE
+
+#endif /* SOURCE_STACKTICKER_H_ */
@@ -0,0 +1,156 @@
+/*
+ * VibrationAnalyzer.h
+ *
+ * Spectrum of a block of high-ODR accelerometer samples.
+ */
+
+#ifndef SOURCE_VIBRATIONANALYZER_H_
+#define SOURCE_VIBRATIONANALYZER_H_
+
+#include <stdint.h>
+#include "FixedPoint.h"
+#include "FixedFft.h"
+
+/** Reduced spectrum of one block, amplitudes in raw accelerometer LSB. */
+struct VibrationSpectrum {
+    static const unsigned BANDS = 4;
+
+    uint16_t peak_hz;
+    uint16_t peak_amplitude;
+    uint16_t band_rms[BANDS];
+};
+
+/**
+ * Collects FFT_SIZE samples of one axis into a preallocated block, then
+ * removes the mean, applies a Hann window and runs a Q15 real FFT.
+ *
+ * The block is scaled up to use the full Q15 range before the transform
+ * (block floating point) and the results are scaled back, so small
+ * vibrations keep their resolution despite the 1/N scaling of the FFT.
+ */
+class VibrationAnalyzer {
+public:
+    static const unsigned FFT_SIZE = 256;
+    static const uint8_t FFT_SIZE_LOG2 = 8;
+
+    VibrationAnalyzer() : _fill(0) { }
+
+    void reset()
+    {
+        _fill = 0;
+    }
+
+    bool full() const
+    {
+        return _fill == FFT_SIZE;
+    }
+
+    void add(int16_t x)
+    {
+        if (_fill < FFT_SIZE) {
+            _block[_fill++] = x;
+        }
+    }
+
+    /**
+     * Transform the captured block and extract peak and band energies.
+     *
+     * @param[in] sample_rate_hz Rate at which the block was captured.
+     * @param[out] result Spectrum summary.
+     */
+    void analyse(uint16_t sample_rate_hz, VibrationSpectrum &result)
+    {
+        int32_t sum = 0;
+        for (unsigned i = 0; i < FFT_SIZE; i++) {
+            sum += _block[i];
+        }
+        int32_t mean = sum / (int32_t)FFT_SIZE;
+
+        int32_t max_abs = 0;
+        for (unsigned i = 0; i < FFT_SIZE; i++) {
+            int32_t d = _block[i] - mean;
+            if (d < 0) {
+                d = -d;
+            }
+            if (d > max_abs) {
+                max_abs = d;
+            }
+        }
+
+        /* shift > 0 scales up, -1 brings a full scale swing back into Q15 */
+        int shift = 0;
+        if (max_abs > INT16_MAX) {
+            shift = -1;
+        } else if (max_abs) {
+            while (shift < 12 && (max_abs << (shift + 1)) <= INT16_MAX) {
+                shift++;
+            }
+        }
+
+        for (unsigned i = 0; i < FFT_SIZE; i++) {
+            int32_t d = _block[i] - mean;
+            d = (shift >= 0) ? (d << shift) : (d >> 1);
+            /* Hann: 0.5 - 0.5 * cos(2 pi i / N) */
+            int32_t w = (32768 - fixed_fft::cos_q15(i * (fixed_fft::MAX_SIZE / FFT_SIZE))) >> 1;
+            _block[i] = (int16_t)((d * w) >> 15);
+        }
+
+        fixed_fft::rfft_q15(_block, _spectrum, FFT_SIZE);
+
+        const unsigned bins = FFT_SIZE / 2;
+        const unsigned bins_per_band = bins / VibrationSpectrum::BANDS;
+        uint32_t peak_power = 0;
+        unsigned peak_bin = 0;
+        uint64_t band_power[VibrationSpectrum::BANDS] = { 0 };
+
+        for (unsigned k = 1; k <= bins; k++) {
+            int32_t re = _spectrum[2 * k];
+            int32_t im = _spectrum[2 * k + 1];
+            uint32_t power = (uint32_t)(re * re) + (uint32_t)(im * im);
+
+            if (power > peak_power) {
+                peak_power = power;
+                peak_bin = k;
+            }
+
+            unsigned band = (k - 1) / bins_per_band;
+            if (band >= VibrationSpectrum::BANDS) {
+                band = VibrationSpectrum::BANDS - 1;
+            }
+            band_power[band] += power;
+        }
+
+        result.peak_hz = (uint16_t)((uint32_t)peak_bin * sample_rate_hz / FFT_SIZE);
+        /* one-sided spectrum (x2) through the Hann coherent gain (x2) */
+        result.peak_amplitude = saturate(unscale(4 * isqrt32(peak_power), shift));
+
+        for (unsigned b = 0; b < VibrationSpectrum::BANDS; b++) {
+            /* Parseval on one side (x2) corrected for the Hann power gain (x8/3) */
+            uint32_t rms = isqrt64(band_power[b] * 16 / 3);
+            result.band_rms[b] = saturate(unscale(rms, shift));
+        }
+
+        _fill = 0;
+    }
+
+private:
+    static uint32_t unscale(uint32_t x, int shift)
+    {
+        return (shift >= 0) ? (x >> shift) : (x << 1);
+    }
+
+    static uint16_t saturate(uint32_t x)
+    {
+        return (x > UINT16_MAX) ? UINT16_MAX : (uint16_t)x;
+    }
+
+    int16_t _block[FFT_SIZE];
+#if defined(FIXED_FFT_USE_CMSIS_DSP)
+    int16_t _spectrum[2 * FFT_SIZE];
+#else
+    int16_t _spectrum[FFT_SIZE + 2];
+#endif
+    uint16_t _fill;
+};
+
+#endif /* SOURCE_VIBRATIONANALYZER_H_ */
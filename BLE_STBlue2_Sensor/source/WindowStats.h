@@ -0,0 +1,99 @@
+/*
+ * WindowStats.h
+ *
+ * Incremental per-window summary of a 16 bit sample stream.
+ */
+
+#ifndef SOURCE_WINDOWSTATS_H_
+#define SOURCE_WINDOWSTATS_H_
+
+#include <stdint.h>
+#include "FixedPoint.h"
+
+/**
+ * Running min/max/sum/sum of squares of the samples added since the last
+ * reset(). No sample is stored; mean, RMS and variance are derived on demand.
+ *
+ * A window holds at most 65535 samples so that n * sum(x^2) stays in 64 bits.
+ */
+class WindowStats {
+public:
+    static const uint16_t MAX_SAMPLES = 0xFFFF;
+
+    WindowStats()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        _count = 0;
+        _min = INT16_MAX;
+        _max = INT16_MIN;
+        _sum = 0;
+        _sum_sq = 0;
+    }
+
+    void add(int16_t x)
+    {
+        if (_count == MAX_SAMPLES) {
+            return;
+        }
+
+        _count++;
+        if (x < _min) {
+            _min = x;
+        }
+        if (x > _max) {
+            _max = x;
+        }
+        _sum += x;
+        _sum_sq += (uint32_t)((int32_t)x * x);
+    }
+
+    uint16_t count() const
+    {
+        return _count;
+    }
+
+    int16_t min() const
+    {
+        return _count ? _min : 0;
+    }
+
+    int16_t max() const
+    {
+        return _count ? _max : 0;
+    }
+
+    int16_t mean() const
+    {
+        return _count ? (int16_t)(_sum / (int32_t)_count) : 0;
+    }
+
+    /** Unsigned: a window of -32768 has an RMS of 32768. */
+    uint16_t rms() const
+    {
+        return _count ? (uint16_t)isqrt32((uint32_t)(_sum_sq / _count)) : 0;
+    }
+
+    /** Population variance in LSB^2. */
+    uint32_t variance() const
+    {
+        if (!_count) {
+            return 0;
+        }
+        int64_t n = _count;
+        int64_t num = n * (int64_t)_sum_sq - (int64_t)_sum * _sum;
+        return (uint32_t)(num / (n * n));
+    }
+
+private:
+    uint16_t _count;
+    int16_t _min;
+    int16_t _max;
+    int32_t _sum;
+    uint64_t _sum_sq;
+};
+
+#endif /* SOURCE_WINDOWSTATS_H_ */
@@ -20,18 +20,30 @@
 #include <SensorDemo.h>
 
 static events::EventQueue event_queue(/* event count */ 16 * EVENTS_EVENT_SIZE);
+static QueueMonitor queue_monitor(event_queue);
+static BLEEventPump event_pump(queue_monitor);
 
-/** Schedule processing of events from the BLE middleware in the event queue. */
-void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *context) {
-    event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
+#if defined(BLUENRG2_DEVICE) && MBED_CONF_APP_STACK_TICK_EVENTS
+/*
+ * The controller interrupt handler of the port calls RAL_Isr(), the stack
+ * handler. Linking with -Wl,--wrap=RAL_Isr (stack_tick_profile.json) routes
+ * that call here.
+ */
+extern "C" void __real_RAL_Isr(void);
+
+extern "C" void __wrap_RAL_Isr(void)
+{
+    __real_RAL_Isr();
+    StackTicker::onControllerInterrupt();
 }
+#endif
 
 int main()
 {
     BLE &ble = BLE::Instance();
-    ble.onEventsToProcess(schedule_ble_events);
+    ble.onEventsToProcess(makeFunctionPointer(&event_pump, &BLEEventPump::schedule));
 
-    SensorDemo demo(ble, event_queue);
+    SensorDemo demo(ble, event_queue, queue_monitor, event_pump);
     demo.start();  //contains dispatch loop
 
     //should never get here
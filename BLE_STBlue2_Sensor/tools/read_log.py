@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+"""Decode the offline sensor log downloaded from BLE_STBlue2_Sensor.
+
+The log is the concatenation of the notifications of the log
+characteristic (00000000-0013-11e1-ac36-0002a5d5c51b) after writing 0x01
+to it, or 0x03 for the plain notification download. Each notification
+starts with a 2 byte chunk index, bit 15 marks the last one. The input is either that payload already reassembled
+(binary, the default) or one notification per line in hex (--hex).
+
+The record layout is described in source/LogFormat.h. Samples are printed
+as CSV: boot, sequence, time in ms since boot, then one column per channel
+(accel Y, X, Z, gyro Y, X, Z in raw LSB and the raw temperature).
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD_MAGIC = 0xB10C
+HEADER = struct.Struct('<HHIIHHBBH')
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in bytearray(data):
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def read_hex_notifications(lines):
+    stream = bytearray()
+    for line in lines:
+        line = line.strip().replace(' ', '').replace('-', '').replace(':', '')
+        if not line:
+            continue
+        chunk = bytearray.fromhex(line)
+        stream += chunk[2:]
+        if struct.unpack_from('<H', chunk)[0] & 0x8000:
+            break
+    return bytes(stream)
+
+
+def decode_varints(payload, count):
+    values = []
+    value = shift = 0
+    for byte in bytearray(payload):
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            values.append((value >> 1) ^ -(value & 1))
+            value = shift = 0
+    return values[:count]
+
+
+def records(data):
+    """Yield (header fields, samples) for every valid record."""
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        (magic, length, sequence, timestamp, boot, interval,
+         channels, count, crc) = HEADER.unpack_from(data, offset)
+        end = offset + HEADER.size + length
+        if magic != RECORD_MAGIC or end > len(data):
+            sys.stderr.write('lost sync at byte %d\n' % offset)
+            return
+        payload = data[offset + HEADER.size:end]
+        if crc16(payload, crc16(data[offset:offset + 18])) != crc:
+            sys.stderr.write('bad CRC in record %d, skipped\n' % sequence)
+        else:
+            deltas = decode_varints(payload, channels * count)
+            samples = []
+            previous = [0] * channels
+            for i in range(count):
+                sample = deltas[i * channels:(i + 1) * channels]
+                if i:
+                    sample = [p + d for p, d in zip(previous, sample)]
+                samples.append(sample)
+                previous = sample
+            yield (boot, sequence, timestamp, interval), samples
+        offset = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('log', help='downloaded log, "-" for stdin')
+    parser.add_argument('--hex', action='store_true',
+                        help='one notification per line in hex')
+    args = parser.parse_args()
+
+    if args.hex:
+        source = sys.stdin if args.log == '-' else open(args.log)
+        data = read_hex_notifications(source)
+    else:
+        source = sys.stdin.buffer if args.log == '-' else open(args.log, 'rb')
+        data = source.read()
+
+    for (boot, sequence, timestamp, interval), samples in records(data):
+        for i, sample in enumerate(samples):
+            fields = [boot, sequence, timestamp + i * interval] + sample
+            print(','.join(str(f) for f in fields))
+
+
+if __name__ == '__main__':
+    main()